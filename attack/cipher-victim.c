@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A victim for every table-based primitive in the bundled OpenSSL: it
+   encrypts a zero buffer in place COUNT times with the selected cipher
+   and mode, or hashes it with Whirlpool. */
+
+#include <openssl/aes.h>
+#include <openssl/blowfish.h>
+#include <openssl/camellia.h>
+#include <openssl/cast.h>
+#include <openssl/des.h>
+#include <openssl/modes.h>
+#include <openssl/seed.h>
+#include <openssl/whrlpool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "victim.h"
+
+enum cipher_id
+{
+  AES,
+  DES,
+  BF,
+  CAST,
+  CAMELLIA,
+  SEED,
+  WHIRLPOOL_HASH,
+};
+
+enum mode_id
+{
+  ECB,
+  CBC,
+  CFB,
+  OFB,
+  CTR,
+  IGE,
+};
+
+typedef union key_schedule
+{
+  AES_KEY aes;
+  DES_key_schedule des;
+  BF_KEY bf;
+  CAST_KEY cast;
+  CAMELLIA_KEY camellia;
+  SEED_KEY_SCHEDULE seed;
+} key_schedule;
+
+typedef struct cipher
+{
+  const char *name;
+  enum cipher_id id;
+  size_t block_size;
+  block128_f block;
+} cipher;
+
+static const cipher ciphers[] = {
+  { "aes", AES, 16, (block128_f)AES_encrypt },
+  { "des", DES, 8, 0 },
+  { "bf", BF, 8, 0 },
+  { "cast", CAST, 8, 0 },
+  { "camellia", CAMELLIA, 16, (block128_f)Camellia_encrypt },
+  { "seed", SEED, 16, (block128_f)SEED_encrypt },
+  { "whirlpool", WHIRLPOOL_HASH, WHIRLPOOL_DIGEST_LENGTH, 0 },
+};
+
+static const char *const modes[] = { "ecb", "cbc", "cfb", "ofb", "ctr", "ige" };
+
+void
+set_key (const cipher *c, key_schedule *ks)
+{
+  switch (c->id)
+    {
+    case AES:
+      AES_set_encrypt_key (key, 128, &ks->aes);
+      break;
+    case DES:
+      DES_set_key_unchecked ((const_DES_cblock *)key, &ks->des);
+      break;
+    case BF:
+      BF_set_key (&ks->bf, sizeof (key), key);
+      break;
+    case CAST:
+      CAST_set_key (&ks->cast, sizeof (key), key);
+      break;
+    case CAMELLIA:
+      Camellia_set_key (key, 128, &ks->camellia);
+      break;
+    case SEED:
+      SEED_set_key (key, &ks->seed);
+      break;
+    case WHIRLPOOL_HASH:
+      break;
+    }
+}
+
+/* Modes of the 128-bit block ciphers, through the generic modes.h. */
+void
+encrypt_128 (const cipher *c, enum mode_id mode, key_schedule *ks,
+             unsigned char *buf, size_t len, unsigned char *iv)
+{
+  unsigned char ecount[16] = {};
+  unsigned int num = 0;
+  int cfb_num = 0;
+  switch (mode)
+    {
+    case ECB:
+      for (size_t i = 0; i < len; i += 16)
+        {
+          c->block (buf + i, buf + i, ks);
+        }
+      break;
+    case CBC:
+      CRYPTO_cbc128_encrypt (buf, buf, len, ks, iv, c->block);
+      break;
+    case CFB:
+      CRYPTO_cfb128_encrypt (buf, buf, len, ks, iv, &cfb_num, AES_ENCRYPT,
+                             c->block);
+      break;
+    case OFB:
+      CRYPTO_ofb128_encrypt (buf, buf, len, ks, iv, &cfb_num, c->block);
+      break;
+    case CTR:
+      CRYPTO_ctr128_encrypt (buf, buf, len, ks, iv, ecount, &num, c->block);
+      break;
+    case IGE:
+      AES_ige_encrypt (buf, buf, len, &ks->aes, iv, AES_ENCRYPT);
+      break;
+    }
+}
+
+/* Modes of the 64-bit block ciphers, through their own functions. */
+void
+encrypt_64 (const cipher *c, enum mode_id mode, key_schedule *ks,
+            unsigned char *buf, size_t len, unsigned char *iv)
+{
+  int num = 0;
+  switch (c->id)
+    {
+    case DES:
+      switch (mode)
+        {
+        case ECB:
+          for (size_t i = 0; i < len; i += 8)
+            {
+              DES_ecb_encrypt ((const_DES_cblock *)(buf + i),
+                               (DES_cblock *)(buf + i), &ks->des,
+                               DES_ENCRYPT);
+            }
+          break;
+        case CBC:
+          DES_ncbc_encrypt (buf, buf, len, &ks->des, (DES_cblock *)iv,
+                            DES_ENCRYPT);
+          break;
+        case CFB:
+          DES_cfb64_encrypt (buf, buf, len, &ks->des, (DES_cblock *)iv, &num,
+                             DES_ENCRYPT);
+          break;
+        case OFB:
+          DES_ofb64_encrypt (buf, buf, len, &ks->des, (DES_cblock *)iv, &num);
+          break;
+        default:
+          break;
+        }
+      break;
+    case BF:
+      switch (mode)
+        {
+        case ECB:
+          for (size_t i = 0; i < len; i += 8)
+            {
+              BF_ecb_encrypt (buf + i, buf + i, &ks->bf, BF_ENCRYPT);
+            }
+          break;
+        case CBC:
+          BF_cbc_encrypt (buf, buf, len, &ks->bf, iv, BF_ENCRYPT);
+          break;
+        case CFB:
+          BF_cfb64_encrypt (buf, buf, len, &ks->bf, iv, &num, BF_ENCRYPT);
+          break;
+        case OFB:
+          BF_ofb64_encrypt (buf, buf, len, &ks->bf, iv, &num);
+          break;
+        default:
+          break;
+        }
+      break;
+    case CAST:
+      switch (mode)
+        {
+        case ECB:
+          for (size_t i = 0; i < len; i += 8)
+            {
+              CAST_ecb_encrypt (buf + i, buf + i, &ks->cast, CAST_ENCRYPT);
+            }
+          break;
+        case CBC:
+          CAST_cbc_encrypt (buf, buf, len, &ks->cast, iv, CAST_ENCRYPT);
+          break;
+        case CFB:
+          CAST_cfb64_encrypt (buf, buf, len, &ks->cast, iv, &num,
+                              CAST_ENCRYPT);
+          break;
+        case OFB:
+          CAST_ofb64_encrypt (buf, buf, len, &ks->cast, iv, &num);
+          break;
+        default:
+          break;
+        }
+      break;
+    default:
+      break;
+    }
+}
+
+/* The keyed workload for a hash: digest the key and the buffer, and
+   leave the digest at the start of the buffer. */
+void
+hash_whirlpool (unsigned char *buf, size_t len)
+{
+  unsigned char md[WHIRLPOOL_DIGEST_LENGTH];
+  WHIRLPOOL_CTX ctx;
+  WHIRLPOOL_Init (&ctx);
+  WHIRLPOOL_Update (&ctx, key, sizeof (key));
+  WHIRLPOOL_Update (&ctx, buf, len);
+  WHIRLPOOL_Final (md, &ctx);
+  memcpy (buf, md, len < sizeof (md) ? len : sizeof (md));
+}
+
+void
+usage (const char *prog)
+{
+  fprintf (stderr,
+           "usage: %s [-c CIPHER] [-m MODE] [-n COUNT] [-b BYTES] "
+           "[KEYFILE]\n"
+           "  -c CIPHER  aes, des, bf, cast, camellia, seed or whirlpool\n"
+           "             (default aes)\n"
+           "  -m MODE    ecb, cbc, cfb, ofb, ctr or ige (default ecb); ctr\n"
+           "             needs a 128-bit block, ige needs aes and whirlpool\n"
+           "             takes none\n"
+           "  -n COUNT   times the buffer is encrypted (default 10)\n"
+           "  -b BYTES   buffer size, a multiple of the block size\n"
+           "             (default one block)\n",
+           prog);
+}
+
+int
+main (int argc, char *argv[argc + 1])
+{
+  const cipher *c = &ciphers[0];
+  enum mode_id mode = ECB;
+  size_t count = 10;
+  size_t len = 0;
+
+  int opt;
+  while ((opt = getopt (argc, argv, "c:m:n:b:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'c':
+          c = 0;
+          for (size_t i = 0; i < sizeof (ciphers) / sizeof (*ciphers); ++i)
+            {
+              if (!strcmp (optarg, ciphers[i].name))
+                {
+                  c = &ciphers[i];
+                }
+            }
+          if (!c)
+            {
+              usage (argv[0]);
+              exit (EXIT_FAILURE);
+            }
+          break;
+        case 'm':
+          mode = sizeof (modes) / sizeof (*modes);
+          for (size_t i = 0; i < sizeof (modes) / sizeof (*modes); ++i)
+            {
+              if (!strcmp (optarg, modes[i]))
+                {
+                  mode = i;
+                }
+            }
+          if (mode == sizeof (modes) / sizeof (*modes))
+            {
+              usage (argv[0]);
+              exit (EXIT_FAILURE);
+            }
+          break;
+        case 'n':
+          count = strtoull (optarg, 0, 0);
+          break;
+        case 'b':
+          len = strtoull (optarg, 0, 0);
+          break;
+        default:
+          usage (argv[0]);
+          exit (EXIT_FAILURE);
+        }
+    }
+  if (c->id == WHIRLPOOL_HASH && mode != ECB)
+    {
+      fprintf (stderr, "%s: whirlpool is a hash and has no mode\n",
+               argv[0]);
+      exit (EXIT_FAILURE);
+    }
+  if (!len)
+    {
+      len = c->block_size;
+    }
+  if ((c->id != WHIRLPOOL_HASH && len % c->block_size)
+      || (mode == CTR && c->block_size != 16)
+      || (mode == IGE && c->id != AES))
+    {
+      usage (argv[0]);
+      exit (EXIT_FAILURE);
+    }
+  if (optind < argc && read_key (argv[optind]) < 0)
+    {
+      perror (argv[optind]);
+      exit (EXIT_FAILURE);
+    }
+
+  unsigned char *buf = calloc (1, len);
+  if (!buf)
+    {
+      exit (EXIT_FAILURE);
+    }
+
+  /* The IV carries over between rounds, so the chaining and stream modes
+     keep going instead of restarting, and IGE chains two blocks of it. */
+  unsigned char iv[2 * 16] = {};
+  key_schedule ks;
+  set_key (c, &ks);
+  for (size_t i = 0; i < count; ++i)
+    {
+      if (c->id == WHIRLPOOL_HASH)
+        {
+          hash_whirlpool (buf, len);
+        }
+      else if (c->block_size == 16)
+        {
+          encrypt_128 (c, mode, &ks, buf, len, iv);
+        }
+      else
+        {
+          encrypt_64 (c, mode, &ks, buf, len, iv);
+        }
+    }
+
+  for (size_t i = 0; i < len; ++i)
+    {
+      printf ("%02x", buf[i]);
+    }
+  printf ("\n");
+  free (buf);
+  exit (EXIT_SUCCESS);
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Shared-memory doorbell between the victim and the attacker.
+
+   For every encryption the victim writes the plaintext, rings REQUEST
+   with the next odd sequence number S ("about to encrypt") and waits
+   until the attacker rings ACK with S. It then encrypts, writes the
+   ciphertext, sets DONE to S and rings REQUEST with S + 1 ("done").
+   When the victim is finished it rings REQUEST with DOORBELL_CLOSED. A
+   victim continues the numbering of the one before it, from REQUEST or,
+   when that is closed, from DONE, so a request left behind by a victim
+   that died is never confused with a new one: DONE is never set for
+   it.
+
+   The attacker attaches by clearing ACK and detaches by ringing it with
+   DOORBELL_CLOSED, which it also does when it stops early, fails or is
+   killed by a signal it can catch. A victim that finds ACK closed goes
+   on without waiting, and waits again once an attacker attaches. Only
+   an attacker killed outright, by SIGKILL, leaves the victim waiting.
+
+   Each bell sits on its own cache line so that the two sides never
+   share a line they write. Waiting spins for a while and then sleeps on
+   a futex, so a tight loop costs no system call while an idle side does
+   not burn a core. */
+
+#ifndef DOORBELL_H
+#define DOORBELL_H
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#define DOORBELL_CLOSED (UINT32_MAX)
+#define DOORBELL_SPINS (1 << 14)
+
+typedef struct bell
+{
+  alignas (64) _Atomic uint32_t value;
+  _Atomic uint32_t sleepers;
+} bell;
+
+typedef struct doorbell
+{
+  bell request;
+  _Atomic uint32_t done;
+  bell ack;
+  alignas (64) uint8_t plain[16];
+  uint8_t cipher[16];
+} doorbell;
+
+static inline void
+bell_ring (bell *b, uint32_t value)
+{
+  atomic_store (&b->value, value);
+  if (atomic_load (&b->sleepers))
+    {
+      syscall (SYS_futex, &b->value, FUTEX_WAKE, INT32_MAX, 0, 0, 0);
+    }
+}
+
+/* Wait until B no longer holds OLD and return its new value. */
+static inline uint32_t
+bell_wait (bell *b, uint32_t old)
+{
+  uint32_t value;
+  for (int i = 0; i < DOORBELL_SPINS; ++i)
+    {
+      value = atomic_load_explicit (&b->value, memory_order_acquire);
+      if (value != old)
+        {
+          return value;
+        }
+      _mm_pause ();
+    }
+
+  atomic_fetch_add (&b->sleepers, 1);
+  while ((value = atomic_load (&b->value)) == old)
+    {
+      syscall (SYS_futex, &b->value, FUTEX_WAIT, old, 0, 0, 0);
+    }
+  atomic_fetch_sub (&b->sleepers, 1);
+  return value;
+}
+
+/* Map the doorbell in the POSIX shared memory object NAME, creating it
+   if it does not exist yet. Either side may come first. */
+static inline doorbell *
+doorbell_open (const char *name)
+{
+  int fd = shm_open (name, O_RDWR | O_CREAT, 0600);
+  if (fd < 0)
+    {
+      return 0;
+    }
+  if (ftruncate (fd, sizeof (doorbell)) < 0)
+    {
+      close (fd);
+      return 0;
+    }
+  void *ptr = mmap (0, sizeof (doorbell), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  close (fd);
+  return ptr == MAP_FAILED ? 0 : ptr;
+}
+
+/* Start acknowledging the requests of D and return the last request
+   value seen, to go on from. A closed doorbell
+   is left over from an earlier victim, so wait for the next one. A
+   request posted before we attached may be running unacknowledged
+   already; acknowledge it and go on from the one after. */
+static inline uint32_t
+doorbell_attach (doorbell *d)
+{
+  atomic_store (&d->ack.value, 0);
+  uint32_t seen = atomic_load (&d->request.value);
+  if (seen == DOORBELL_CLOSED)
+    {
+      seen = bell_wait (&d->request, seen);
+    }
+  if (seen != DOORBELL_CLOSED && seen & 1)
+    {
+      bell_ring (&d->ack, seen);
+      seen = bell_wait (&d->request, seen);
+    }
+  return seen;
+}
+
+/* Let the victim behind D go on without waiting for acknowledgements.
+   Safe to call from a signal handler. */
+static inline void
+doorbell_detach (doorbell *d)
+{
+  bell_ring (&d->ack, DOORBELL_CLOSED);
+}
+
+/* Wait until the attacker acknowledges REQUEST on D or has detached. */
+static inline void
+doorbell_wait_ack (doorbell *d, uint32_t request)
+{
+  uint32_t ack = atomic_load (&d->ack.value);
+  while (ack != request && ack != DOORBELL_CLOSED)
+    {
+      ack = bell_wait (&d->ack, ack);
+    }
+}
+
+static inline void
+doorbell_close (doorbell *d)
+{
+  munmap (d, sizeof (*d));
+}
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* An AES-128 victim on the EVP interface, which picks the fastest
+   implementation the CPU allows: AES-NI, else the SSSE3 vector
+   permutation code, else the T-tables. -i checks that OPENSSL_ia32cap
+   masks the capability bits so that the chosen one is used, and a
+   buffer of any size is encrypted in place COUNT times. */
+
+#include <limits.h>
+#include <openssl/evp.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "victim.h"
+
+/* The capability words are parsed when libcrypto is loaded, so the
+   mask has to be in the environment the program starts with. Bit 57 is
+   AES-NI and bit 41 is SSSE3, which vpaes needs. With SSSE3 but no
+   AES-NI, CTR goes through the bit-sliced bsaes code rather than
+   vpaes, so only ECB and CBC exercise vpaes itself. */
+typedef struct implementation
+{
+  const char *name;
+  const char *ia32cap;
+} implementation;
+
+static const implementation implementations[] = {
+  { "ttable", "~0x200020000000000" },
+  { "vpaes", "~0x200000000000000" },
+  { "aesni", 0 },
+};
+
+typedef struct mode
+{
+  const char *name;
+  const EVP_CIPHER *(*cipher) (void);
+} mode;
+
+static const mode modes[] = {
+  { "ecb", EVP_aes_128_ecb },
+  { "cbc", EVP_aes_128_cbc },
+  { "ctr", EVP_aes_128_ctr },
+};
+
+/* Fail unless OPENSSL_ia32cap is IA32CAP, or unset for an IA32CAP of
+   null, so that NAME is the implementation OpenSSL picked. */
+void
+check_implementation (const char *name, const char *ia32cap)
+{
+  const char *current = getenv ("OPENSSL_ia32cap");
+  if (ia32cap ? current && !strcmp (current, ia32cap) : !current)
+    {
+      return;
+    }
+  if (ia32cap)
+    {
+      fprintf (stderr, "-i %s needs OPENSSL_ia32cap=%s\n", name, ia32cap);
+    }
+  else
+    {
+      fprintf (stderr, "-i %s needs OPENSSL_ia32cap unset\n", name);
+    }
+  exit (EXIT_FAILURE);
+}
+
+void
+usage (const char *prog)
+{
+  fprintf (stderr,
+           "usage: %s [-i ttable|vpaes|aesni] [-m ecb|cbc|ctr] [-n COUNT] "
+           "[-b BYTES] [KEYFILE]\n"
+           "  -i IMPL   check that OPENSSL_ia32cap forces the T-table,\n"
+           "            vpaes or AES-NI implementation: ~0x200020000000000,\n"
+           "            ~0x200000000000000 or unset; vpaes in ctr mode is\n"
+           "            the bit-sliced bsaes, and a library built without\n"
+           "            assembly only has T-tables (default whatever\n"
+           "            OPENSSL_ia32cap allows)\n"
+           "  -m MODE   mode of operation (default ecb)\n"
+           "  -n COUNT  times the buffer is encrypted (default 10)\n"
+           "  -b BYTES  buffer size, a multiple of 16 (default 16)\n",
+           prog);
+}
+
+int
+main (int argc, char *argv[argc + 1])
+{
+  const implementation *impl = 0;
+  const mode *m = &modes[0];
+  size_t count = 10;
+  size_t len = 16;
+
+  int opt;
+  while ((opt = getopt (argc, argv, "i:m:n:b:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'i':
+          impl = 0;
+          for (size_t i = 0;
+               i < sizeof (implementations) / sizeof (*implementations); ++i)
+            {
+              if (!strcmp (optarg, implementations[i].name))
+                {
+                  impl = &implementations[i];
+                }
+            }
+          if (!impl)
+            {
+              usage (argv[0]);
+              exit (EXIT_FAILURE);
+            }
+          break;
+        case 'm':
+          m = 0;
+          for (size_t i = 0; i < sizeof (modes) / sizeof (*modes); ++i)
+            {
+              if (!strcmp (optarg, modes[i].name))
+                {
+                  m = &modes[i];
+                }
+            }
+          if (!m)
+            {
+              usage (argv[0]);
+              exit (EXIT_FAILURE);
+            }
+          break;
+        case 'n':
+          count = strtoull (optarg, 0, 0);
+          break;
+        case 'b':
+          len = strtoull (optarg, 0, 0);
+          break;
+        default:
+          usage (argv[0]);
+          exit (EXIT_FAILURE);
+        }
+    }
+  if (!len || len % 16 || len > INT_MAX || optind + 1 < argc)
+    {
+      usage (argv[0]);
+      exit (EXIT_FAILURE);
+    }
+  if (impl)
+    {
+      check_implementation (impl->name, impl->ia32cap);
+    }
+  if (optind < argc && read_key (argv[optind]) < 0)
+    {
+      perror (argv[optind]);
+      exit (EXIT_FAILURE);
+    }
+
+  unsigned char *buf = calloc (1, len);
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new ();
+  unsigned char iv[16] = {};
+  if (!buf || !ctx || !EVP_EncryptInit_ex (ctx, m->cipher (), 0, key, iv))
+    {
+      exit (EXIT_FAILURE);
+    }
+  EVP_CIPHER_CTX_set_padding (ctx, 0);
+
+  /* One context for all rounds, so the chaining and counter modes keep
+     going from where the round before stopped. */
+  for (size_t i = 0; i < count; ++i)
+    {
+      int n;
+      if (!EVP_EncryptUpdate (ctx, buf, &n, buf, len))
+        {
+          exit (EXIT_FAILURE);
+        }
+    }
+
+  for (size_t i = 0; i < 16; ++i)
+    {
+      printf ("%02x", buf[len - 16 + i]);
+    }
+  printf ("\n");
+  EVP_CIPHER_CTX_free (ctx);
+  free (buf);
+  exit (EXIT_SUCCESS);
+}
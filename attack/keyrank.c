@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keyrank.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Keep rates off 0 and 1, where the log-likelihood is infinite. */
+#define MIN_RATE (1e-6)
+
+static double
+clamp_rate (double rate)
+{
+  return rate < MIN_RATE       ? MIN_RATE
+         : rate > 1 - MIN_RATE ? 1 - MIN_RATE
+                               : rate;
+}
+
+void
+keyrank_logp (const key_score *score, key_logp *logp)
+{
+  double n = score->nsample;
+  for (size_t i = 0; i < 16; ++i)
+    {
+      const uint64_t *h = score->hits[i];
+      uint64_t best = 0, sum = 0;
+      for (size_t k = 0; k < 256; ++k)
+        {
+          best = h[k] > best ? h[k] : best;
+          sum += h[k];
+        }
+      double p1 = n ? clamp_rate (best / n) : 0.5;
+      double q = n ? clamp_rate (sum / (256 * n)) : 0.5;
+      double hit_weight = p1 > q ? log (p1 / q) : 0;
+      double miss_weight = p1 > q ? log ((1 - p1) / (1 - q)) : 0;
+
+      double max = -INFINITY;
+      for (size_t k = 0; k < 256; ++k)
+        {
+          logp->logp[i][k]
+              = h[k] * hit_weight + (score->nsample - h[k]) * miss_weight;
+          max = logp->logp[i][k] > max ? logp->logp[i][k] : max;
+        }
+      double total = 0;
+      for (size_t k = 0; k < 256; ++k)
+        {
+          total += exp (logp->logp[i][k] - max);
+        }
+      for (size_t k = 0; k < 256; ++k)
+        {
+          logp->logp[i][k] -= max + log (total);
+        }
+    }
+}
+
+_Static_assert (KEYRANK_NBIN <= 256, "bins must fit in a byte");
+
+void
+keyrank_bin (const key_logp *logp, uint8_t bin[16][256])
+{
+  double max_cost = 0;
+  for (size_t i = 0; i < 16; ++i)
+    {
+      for (size_t k = 0; k < 256; ++k)
+        {
+          max_cost = -logp->logp[i][k] > max_cost ? -logp->logp[i][k]
+                                                  : max_cost;
+        }
+    }
+  double width = max_cost > 0 ? max_cost / (KEYRANK_NBIN - 1) : 1;
+  for (size_t i = 0; i < 16; ++i)
+    {
+      for (size_t k = 0; k < 256; ++k)
+        {
+          size_t b = -logp->logp[i][k] / width;
+          bin[i][k] = b < KEYRANK_NBIN ? b : KEYRANK_NBIN - 1;
+        }
+    }
+}
+
+/* Binning a byte's cost -LOGP down to the bin below it errs by less than
+   a bin, so a key's bin sum is at most 16 bins below its cost. A key 16
+   bins below the true key is surely more likely, and one that is not
+   below the true key's bin plus 16 is surely not. */
+int
+keyrank_estimate (const key_logp *logp, const uint8_t key[16], double *lo,
+                  double *hi)
+{
+  uint8_t bin[16][256];
+  keyrank_bin (logp, bin);
+
+  size_t nbin = 16 * (KEYRANK_NBIN - 1) + 1;
+  double *sum = calloc (nbin, sizeof (*sum));
+  double *next = calloc (nbin, sizeof (*next));
+  if (!sum || !next)
+    {
+      free (sum);
+      free (next);
+      return -1;
+    }
+
+  sum[0] = 1;
+  size_t used = 1, key_bin = 0;
+  for (size_t i = 0; i < 16; ++i)
+    {
+      double byte[KEYRANK_NBIN] = {};
+      for (size_t k = 0; k < 256; ++k)
+        {
+          byte[bin[i][k]] += 1;
+        }
+      key_bin += bin[i][key[i]];
+
+      for (size_t s = 0; s < used + KEYRANK_NBIN - 1; ++s)
+        {
+          next[s] = 0;
+        }
+      for (size_t s = 0; s < used; ++s)
+        {
+          if (!sum[s])
+            {
+              continue;
+            }
+          for (size_t b = 0; b < KEYRANK_NBIN; ++b)
+            {
+              next[s + b] += sum[s] * byte[b];
+            }
+        }
+      used += KEYRANK_NBIN - 1;
+      double *swap = sum;
+      sum = next;
+      next = swap;
+    }
+
+  *lo = *hi = 0;
+  for (size_t s = 0; s < used; ++s)
+    {
+      if (s + 16 <= key_bin)
+        {
+          *lo += sum[s];
+        }
+      if (s < key_bin + 16)
+        {
+          *hi += sum[s];
+        }
+    }
+  free (sum);
+  free (next);
+  return 0;
+}
+
+int
+score_write (FILE *file, const key_score *score)
+{
+  fprintf (file, "%" PRIu64 "\n", score->nsample);
+  for (size_t i = 0; i < 16; ++i)
+    {
+      for (size_t k = 0; k < 256; ++k)
+        {
+          fprintf (file, k ? " %" PRIu64 : "%" PRIu64, score->hits[i][k]);
+        }
+      fprintf (file, "\n");
+    }
+  return ferror (file) ? -1 : 0;
+}
+
+int
+score_read (FILE *file, key_score *score)
+{
+  if (fscanf (file, "%" SCNu64, &score->nsample) != 1)
+    {
+      return -1;
+    }
+  for (size_t i = 0; i < 16; ++i)
+    {
+      for (size_t k = 0; k < 256; ++k)
+        {
+          if (fscanf (file, "%" SCNu64, &score->hits[i][k]) != 1)
+            {
+              return -1;
+            }
+        }
+    }
+  return 0;
+}
+
+int
+parse_key (const char *hex, uint8_t key[16])
+{
+  if (strlen (hex) != 32 || strspn (hex, "0123456789abcdefABCDEF") != 32)
+    {
+      return -1;
+    }
+  for (size_t i = 0; i < 16; ++i)
+    {
+      unsigned int byte;
+      if (sscanf (hex + 2 * i, "%2x", &byte) != 1)
+        {
+          return -1;
+        }
+      key[i] = byte;
+    }
+  return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Rank of the true key among all keys, ordered by the likelihood the
+   key-byte scores give them, bounded without enumerating the keys: the
+   16 per-byte log-probabilities are binned into histograms, which are
+   convolved into the histogram of the whole key. */
+
+#ifndef KEYRANK_H
+#define KEYRANK_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "score.h"
+
+#define KEYRANK_NBIN (256)
+
+/* LOGP[I][K] is the natural log of the probability that key byte I is
+   K. */
+typedef struct key_logp
+{
+  double logp[16][256];
+} key_logp;
+
+/* Turn hit counts into log-probabilities. A correct guess sees its line
+   hit at the rate of the best guess, a wrong one at the mean rate of all
+   guesses; each guess is weighed by the likelihood of its hit count
+   under the first against the second. */
+void keyrank_logp (const key_score *score, key_logp *logp);
+
+/* Bin the cost -LOGP[I][K] of every key byte guess into BIN[I][K], one
+   of KEYRANK_NBIN bins of equal width up to the greatest cost. The rank
+   estimate and the enumeration of keysearch both go by these bins. */
+void keyrank_bin (const key_logp *logp, uint8_t bin[16][256]);
+
+/* Bound the number of keys more likely than KEY to [LO, HI] and return
+   0, or return -1 when out of memory. */
+int keyrank_estimate (const key_logp *logp, const uint8_t key[16], double *lo,
+                      double *hi);
+
+/* Write SCORE to FILE as text: the sample count, then the 256 hit
+   counts of each key byte on a line, and read it back. */
+int score_write (FILE *file, const key_score *score);
+int score_read (FILE *file, key_score *score);
+
+/* Parse 32 hex digits into KEY. */
+int parse_key (const char *hex, uint8_t key[16]);
+
+#endif
@@ -0,0 +1,420 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Key enumeration: finish a partial key recovery by trying keys in the
+   order the raccoon scores rank them, against one known plaintext and
+   ciphertext.
+
+   The cost -log p of every key byte guess is binned as for the rank
+   estimate, and keys are tried by increasing bin sum; within one sum
+   the order is arbitrary. A table of the sums the bytes from I on can
+   add up to prunes every branch that cannot reach the sum being
+   enumerated. The work is cut into tasks, one per sum and guess of the
+   first byte, which the threads take in order from a shared counter,
+   so that all of them work near the front of the order. Candidates are
+   checked eight at a time with the AES-NI instructions, which
+   interleave well. */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wmmintrin.h>
+
+#include "keyrank.h"
+
+#define MAX_SUM (16 * (KEYRANK_NBIN - 1))
+#define BATCH (8)
+/* Keys a thread tries at most before it adds them to the shared count
+   and checks the limit. */
+#define REPORT_KEYS (1 << 16)
+
+typedef struct candidate
+{
+  uint8_t byte;
+  uint8_t bin;
+} candidate;
+
+typedef struct search
+{
+  /* The guesses of every key byte by increasing bin. */
+  candidate cand[16][256];
+  /* REACH[I][S] is nonzero when bytes I to 15 can add up to S. */
+  uint8_t reach[17][MAX_SUM + 1];
+  uint8_t plain[16];
+  uint8_t cipher[16];
+  size_t iterations;
+  /* The scores are of the last round key. */
+  int last;
+  uint64_t max_keys;
+  uint64_t report_keys;
+
+  _Atomic uint64_t next_task;
+  _Atomic uint64_t tried;
+  _Atomic int done;
+  _Atomic int found;
+  uint8_t key[16];
+} search;
+
+typedef struct worker
+{
+  search *s;
+  uint8_t key[16];
+  uint8_t batch[BATCH][16];
+  size_t nbatch;
+  uint64_t tried;
+} worker;
+
+static inline __m128i
+expand_step (__m128i k, __m128i assist)
+{
+  assist = _mm_shuffle_epi32 (assist, 0xff);
+  k = _mm_xor_si128 (k, _mm_slli_si128 (k, 4));
+  k = _mm_xor_si128 (k, _mm_slli_si128 (k, 4));
+  k = _mm_xor_si128 (k, _mm_slli_si128 (k, 4));
+  return _mm_xor_si128 (k, assist);
+}
+
+/* The round constant is an immediate, so every round is spelled out. */
+#define EXPAND_ROUND(rk, n, r, rcon)                                          \
+  for (size_t j = 0; j < (n); ++j)                                            \
+    {                                                                         \
+      rk[j][r] = expand_step (rk[j][(r)-1],                                   \
+                              _mm_aeskeygenassist_si128 (rk[j][(r)-1], rcon)); \
+    }
+
+/* Encrypt the known plaintext under the N keys of W's batch and return
+   the index of the one that gives the known ciphertext, or -1. */
+static int
+check_batch (const search *s, worker *w, size_t n)
+{
+  __m128i rk[BATCH][11];
+  for (size_t j = 0; j < n; ++j)
+    {
+      rk[j][0] = _mm_loadu_si128 ((const __m128i *)w->batch[j]);
+    }
+  EXPAND_ROUND (rk, n, 1, 0x01);
+  EXPAND_ROUND (rk, n, 2, 0x02);
+  EXPAND_ROUND (rk, n, 3, 0x04);
+  EXPAND_ROUND (rk, n, 4, 0x08);
+  EXPAND_ROUND (rk, n, 5, 0x10);
+  EXPAND_ROUND (rk, n, 6, 0x20);
+  EXPAND_ROUND (rk, n, 7, 0x40);
+  EXPAND_ROUND (rk, n, 8, 0x80);
+  EXPAND_ROUND (rk, n, 9, 0x1b);
+  EXPAND_ROUND (rk, n, 10, 0x36);
+
+  __m128i x[BATCH];
+  for (size_t j = 0; j < n; ++j)
+    {
+      x[j] = _mm_loadu_si128 ((const __m128i *)s->plain);
+    }
+  for (size_t it = 0; it < s->iterations; ++it)
+    {
+      for (size_t j = 0; j < n; ++j)
+        {
+          x[j] = _mm_xor_si128 (x[j], rk[j][0]);
+        }
+      for (size_t r = 1; r < 10; ++r)
+        {
+          for (size_t j = 0; j < n; ++j)
+            {
+              x[j] = _mm_aesenc_si128 (x[j], rk[j][r]);
+            }
+        }
+      for (size_t j = 0; j < n; ++j)
+        {
+          x[j] = _mm_aesenclast_si128 (x[j], rk[j][10]);
+        }
+    }
+
+  __m128i c = _mm_loadu_si128 ((const __m128i *)s->cipher);
+  for (size_t j = 0; j < n; ++j)
+    {
+      if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (x[j], c)) == 0xffff)
+        {
+          return j;
+        }
+    }
+  return -1;
+}
+
+/* Check the batch of W and account for it; return nonzero when the
+   search is over. */
+static int
+flush_batch (worker *w)
+{
+  search *s = w->s;
+  for (size_t j = 0; s->last && j < w->nbatch; ++j)
+    {
+      aes_first_round_key (w->batch[j], w->batch[j]);
+    }
+  int found = check_batch (s, w, w->nbatch);
+  if (found >= 0 && !atomic_exchange (&s->found, 1))
+    {
+      memcpy (s->key, w->batch[found], 16);
+      atomic_store (&s->done, 1);
+    }
+  w->tried += w->nbatch;
+  w->nbatch = 0;
+  if (w->tried >= s->report_keys)
+    {
+      uint64_t tried = atomic_fetch_add (&s->tried, w->tried) + w->tried;
+      w->tried = 0;
+      if (tried >= s->max_keys)
+        {
+          atomic_store (&s->done, 1);
+        }
+    }
+  return atomic_load_explicit (&s->done, memory_order_relaxed);
+}
+
+/* Try every key whose bytes from I on add up to SUM; return nonzero
+   when the search is over. */
+static int
+enumerate (worker *w, size_t i, size_t sum)
+{
+  const search *s = w->s;
+  if (i == 16)
+    {
+      memcpy (w->batch[w->nbatch++], w->key, 16);
+      return w->nbatch == BATCH ? flush_batch (w) : 0;
+    }
+  for (size_t j = 0; j < 256 && s->cand[i][j].bin <= sum; ++j)
+    {
+      if (!s->reach[i + 1][sum - s->cand[i][j].bin])
+        {
+          continue;
+        }
+      w->key[i] = s->cand[i][j].byte;
+      if (enumerate (w, i + 1, sum - s->cand[i][j].bin))
+        {
+          return 1;
+        }
+    }
+  return 0;
+}
+
+static void *
+run_worker (void *arg)
+{
+  worker *w = arg;
+  search *s = w->s;
+  while (!atomic_load_explicit (&s->done, memory_order_relaxed))
+    {
+      uint64_t task = atomic_fetch_add (&s->next_task, 1);
+      size_t sum = task / 256;
+      const candidate *c = &s->cand[0][task % 256];
+      if (sum > MAX_SUM)
+        {
+          break;
+        }
+      if (c->bin > sum || !s->reach[1][sum - c->bin])
+        {
+          continue;
+        }
+      w->key[0] = c->byte;
+      if (enumerate (w, 1, sum - c->bin))
+        {
+          break;
+        }
+      if (w->nbatch && flush_batch (w))
+        {
+          break;
+        }
+    }
+  atomic_fetch_add (&s->tried, w->tried);
+  return 0;
+}
+
+static int
+compare_candidate (const void *a, const void *b)
+{
+  const candidate *x = a, *y = b;
+  return (x->bin > y->bin) - (x->bin < y->bin);
+}
+
+/* Bin the costs of LOGP into the candidates and reach table of S. */
+static void
+search_init (search *s, const key_logp *logp)
+{
+  uint8_t bin[16][256];
+  keyrank_bin (logp, bin);
+  for (size_t i = 0; i < 16; ++i)
+    {
+      for (size_t k = 0; k < 256; ++k)
+        {
+          s->cand[i][k].byte = k;
+          s->cand[i][k].bin = bin[i][k];
+        }
+      qsort (s->cand[i], 256, sizeof (candidate), compare_candidate);
+    }
+
+  memset (s->reach, 0, sizeof (s->reach));
+  s->reach[16][0] = 1;
+  for (size_t i = 16; i-- > 0;)
+    {
+      for (size_t sum = 0; sum <= MAX_SUM; ++sum)
+        {
+          if (!s->reach[i + 1][sum])
+            {
+              continue;
+            }
+          for (size_t j = 0; j < 256; ++j)
+            {
+              if (sum + s->cand[i][j].bin <= MAX_SUM)
+                {
+                  s->reach[i][sum + s->cand[i][j].bin] = 1;
+                }
+            }
+        }
+    }
+}
+
+static void
+usage (const char *prog)
+{
+  fprintf (stderr,
+           "usage: %s -p PLAIN -c CIPHER [-i ITERATIONS] [-l] [-m BITS] "
+           "[-t THREADS] SCORES\n"
+           "  -p PLAIN       known plaintext in hex\n"
+           "  -c CIPHER      its ciphertext in hex, as in the pair line of\n"
+           "                 raccoon\n"
+           "  -i ITERATIONS  times PLAIN was encrypted in place to give\n"
+           "                 CIPHER (default 1; victim encrypts COUNT\n"
+           "                 times, 10 by default)\n"
+           "  -l             the scores are of the last round key, from\n"
+           "                 raccoon -l\n"
+           "  -m BITS        give up after 2^BITS keys (default 40)\n"
+           "  -t THREADS     number of threads (default one per CPU)\n"
+           "  SCORES         key-byte scores written by raccoon -S\n",
+           prog);
+}
+
+int
+main (int argc, char *argv[argc + 1])
+{
+  search *s = calloc (1, sizeof (*s));
+  key_score *score = malloc (sizeof (*score));
+  key_logp *logp = malloc (sizeof (*logp));
+  if (!s || !score || !logp)
+    {
+      exit (EXIT_FAILURE);
+    }
+  s->iterations = 1;
+  double max_bits = 40;
+  long nthread = sysconf (_SC_NPROCESSORS_ONLN);
+  int have_plain = 0, have_cipher = 0;
+
+  int opt;
+  while ((opt = getopt (argc, argv, "p:c:i:lm:t:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'p':
+          have_plain = !parse_key (optarg, s->plain);
+          break;
+        case 'c':
+          have_cipher = !parse_key (optarg, s->cipher);
+          break;
+        case 'i':
+          s->iterations = strtoull (optarg, 0, 0);
+          break;
+        case 'l':
+          s->last = 1;
+          break;
+        case 'm':
+          max_bits = strtod (optarg, 0);
+          break;
+        case 't':
+          nthread = strtol (optarg, 0, 0);
+          break;
+        default:
+          usage (argv[0]);
+          exit (EXIT_FAILURE);
+        }
+    }
+  if (!have_plain || !have_cipher || nthread < 1 || max_bits < 0
+      || max_bits >= 64 || optind + 1 != argc)
+    {
+      usage (argv[0]);
+      exit (EXIT_FAILURE);
+    }
+  s->max_keys = exp2 (max_bits);
+  /* Report often enough that the threads together overshoot the limit
+     by no more than a sixteenth of it, or a batch each. */
+  s->report_keys = s->max_keys / (16 * nthread);
+  s->report_keys = s->report_keys < BATCH         ? BATCH
+                   : s->report_keys > REPORT_KEYS ? REPORT_KEYS
+                                                  : s->report_keys;
+
+  const char *path = argv[optind];
+  FILE *file = fopen (path, "r");
+  if (!file || score_read (file, score) < 0)
+    {
+      fprintf (stderr, "%s: cannot read scores\n", path);
+      exit (EXIT_FAILURE);
+    }
+  fclose (file);
+
+  keyrank_logp (score, logp);
+  search_init (s, logp);
+
+  worker *w = calloc (nthread, sizeof (*w));
+  pthread_t *thread = calloc (nthread, sizeof (*thread));
+  if (!w || !thread)
+    {
+      exit (EXIT_FAILURE);
+    }
+  for (long i = 0; i < nthread; ++i)
+    {
+      w[i].s = s;
+      if (pthread_create (&thread[i], 0, run_worker, &w[i]))
+        {
+          exit (EXIT_FAILURE);
+        }
+    }
+  for (long i = 0; i < nthread; ++i)
+    {
+      pthread_join (thread[i], 0);
+    }
+
+  uint64_t tried = atomic_load (&s->tried);
+  fprintf (stderr, "tried 2^%.1f keys\n", log2 (tried + 1));
+  if (!atomic_load (&s->found))
+    {
+      fprintf (stderr, "key not found\n");
+      exit (EXIT_FAILURE);
+    }
+  printf ("key");
+  for (size_t i = 0; i < 16; ++i)
+    {
+      printf (" %02x", s->key[i]);
+    }
+  printf ("\n");
+
+  free (thread);
+  free (w);
+  free (logp);
+  free (score);
+  free (s);
+  exit (EXIT_SUCCESS);
+}
@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Per-PC leakage estimates in bits.
+
+   Each argument is a pinatrace-style trace recorded under one secret,
+   optionally prefixed with the secret's label as LABEL=TRACE; traces
+   without a label get their own. Traces sharing a label are repeated
+   runs under the same secret. For every PC the traces are streamed into
+   joint counts of (label, cache line) and (label, page), and the mutual
+   information between the label and the line or page touched is
+   reported per access.
+
+   Lines and pages are folded into a fixed number of buckets per PC, so
+   the counts stay compact however many distinct addresses a PC touches.
+   Folding loses resolution: lines or pages that the secret tells apart
+   may share a bucket. The plug-in estimate is biased upward on small
+   samples and the correction only takes off part of that, so the
+   figures are estimates rather than bounds either way. */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define LINE_BITS (6)
+#define PAGE_BITS (12)
+
+enum granularity
+{
+  LINE,
+  PAGE,
+  NGRANULARITY
+};
+
+typedef struct trace_job
+{
+  const char *path;
+  uint32_t label;
+  unsigned nbucket;
+  uint64_t pc_lo;
+  uint64_t pc_hi;
+  trace_table table;
+  int error;
+} trace_job;
+
+typedef struct pc_leakage
+{
+  uint64_t pc;
+  uint64_t accesses;
+  double bits[NGRANULARITY];
+} pc_leakage;
+
+/* Count an access of PC to bucket KEY in a trace under LABEL, which
+   the entry keeps as its VALUE. */
+static int
+table_add (trace_table *table, uint64_t pc, uint32_t key, uint32_t label)
+{
+  trace_entry *e = trace_table_get (table, pc, key);
+  if (!e)
+    {
+      return -1;
+    }
+  e->value = label;
+  ++e->count;
+  return 0;
+}
+
+static void *
+count_trace (void *arg)
+{
+  trace_job *job = arg;
+  FILE *file = fopen (job->path, "r");
+  if (!file || trace_table_init (&job->table, 1 << 12) < 0)
+    {
+      job->error = errno;
+      if (file)
+        {
+          fclose (file);
+        }
+      return 0;
+    }
+  setvbuf (file, 0, _IOFBF, 1 << 20);
+
+  char *line = 0;
+  size_t cap = 0;
+  while (getline (&line, &cap, file) > 0)
+    {
+      uint64_t pc, addr;
+      if (parse_access (line, &pc, &addr) < 0 || pc < job->pc_lo
+          || pc >= job->pc_hi)
+        {
+          continue;
+        }
+      uint32_t line_key = mix (addr >> LINE_BITS) & (job->nbucket - 1);
+      uint32_t page_key = mix (addr >> PAGE_BITS) & (job->nbucket - 1);
+      if (table_add (&job->table, pc, LINE * job->nbucket + line_key,
+                     job->label)
+              < 0
+          || table_add (&job->table, pc, PAGE * job->nbucket + page_key,
+                        job->label)
+                 < 0)
+        {
+          job->error = ENOMEM;
+          break;
+        }
+    }
+  if (ferror (file))
+    {
+      job->error = errno;
+    }
+  free (line);
+  fclose (file);
+  return 0;
+}
+
+static int
+compare_count (const void *a, const void *b)
+{
+  const trace_entry *x = a, *y = b;
+  if (x->pc != y->pc)
+    {
+      return (x->pc > y->pc) - (x->pc < y->pc);
+    }
+  if (x->key != y->key)
+    {
+      return (x->key > y->key) - (x->key < y->key);
+    }
+  return (x->value > y->value) - (x->value < y->value);
+}
+
+static int
+compare_leakage (const void *a, const void *b)
+{
+  const pc_leakage *x = a, *y = b;
+  if (x->bits[LINE] != y->bits[LINE])
+    {
+      return x->bits[LINE] < y->bits[LINE] ? 1 : -1;
+    }
+  return (x->pc > y->pc) - (x->pc < y->pc);
+}
+
+static double
+plogp (double p)
+{
+  return p > 0 ? p * log2 (p) : 0;
+}
+
+/* Plug-in estimate of I(label; bucket) from the joint counts of one PC
+   at one granularity, with the Miller-Madow correction for the upward
+   bias of small samples. */
+static double
+mutual_information (const trace_entry *c, size_t n, size_t nlabel,
+                    unsigned nbucket, uint64_t *label_count,
+                    uint64_t *bucket_count)
+{
+  memset (label_count, 0, nlabel * sizeof (*label_count));
+  memset (bucket_count, 0, nbucket * sizeof (*bucket_count));
+  double total = 0;
+  for (size_t i = 0; i < n; ++i)
+    {
+      label_count[c[i].value] += c[i].count;
+      bucket_count[c[i].key % nbucket] += c[i].count;
+      total += c[i].count;
+    }
+
+  double h_joint = 0, h_label = 0, h_bucket = 0;
+  size_t used_label = 0, used_bucket = 0;
+  for (size_t i = 0; i < n; ++i)
+    {
+      h_joint -= plogp (c[i].count / total);
+    }
+  for (size_t i = 0; i < nlabel; ++i)
+    {
+      h_label -= plogp (label_count[i] / total);
+      used_label += label_count[i] != 0;
+    }
+  for (size_t i = 0; i < nbucket; ++i)
+    {
+      h_bucket -= plogp (bucket_count[i] / total);
+      used_bucket += bucket_count[i] != 0;
+    }
+
+  double bias = ((double)n - used_label - used_bucket + 1)
+                / (2 * total * log (2));
+  double bits = h_label + h_bucket - h_joint - bias;
+  double bound = h_label < h_bucket ? h_label : h_bucket;
+  return bits < 0 ? 0 : bits > bound ? bound : bits;
+}
+
+static void
+usage (const char *prog)
+{
+  fprintf (stderr,
+           "usage: %s [-b BUCKETS] [-r LO:HI] [LABEL=]TRACE...\n"
+           "  -b BUCKETS  lines or pages kept apart per PC, a power of 2\n"
+           "              (default 1024)\n"
+           "  -r LO:HI    only consider PCs in [LO, HI), in hex\n",
+           prog);
+}
+
+int
+main (int argc, char *argv[argc + 1])
+{
+  unsigned nbucket = 1024;
+  uint64_t pc_lo = 0, pc_hi = UINT64_MAX;
+
+  int opt;
+  while ((opt = getopt (argc, argv, "b:r:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'b':
+          nbucket = strtoul (optarg, 0, 0);
+          if (!nbucket || (nbucket & (nbucket - 1)) || nbucket > 1 << 24)
+            {
+              usage (argv[0]);
+              exit (EXIT_FAILURE);
+            }
+          break;
+        case 'r':
+          if (sscanf (optarg, "%" SCNx64 ":%" SCNx64, &pc_lo, &pc_hi) != 2)
+            {
+              usage (argv[0]);
+              exit (EXIT_FAILURE);
+            }
+          break;
+        default:
+          usage (argv[0]);
+          exit (EXIT_FAILURE);
+        }
+    }
+
+  size_t ntrace = argc - optind;
+  if (!ntrace)
+    {
+      usage (argv[0]);
+      exit (EXIT_FAILURE);
+    }
+
+  trace_job *job = calloc (ntrace, sizeof (*job));
+  pthread_t *thread = calloc (ntrace, sizeof (*thread));
+  if (!job || !thread)
+    {
+      exit (EXIT_FAILURE);
+    }
+
+  /* Number the labels in order of first appearance. */
+  size_t nlabel = 0;
+  for (size_t i = 0; i < ntrace; ++i)
+    {
+      char *arg = argv[optind + i];
+      char *eq = strchr (arg, '=');
+      job[i].path = eq ? eq + 1 : arg;
+      job[i].label = nlabel;
+      if (eq)
+        {
+          *eq = 0;
+          for (size_t j = 0; j < i; ++j)
+            {
+              if (argv[optind + j] != job[j].path
+                  && !strcmp (argv[optind + j], arg))
+                {
+                  job[i].label = job[j].label;
+                  break;
+                }
+            }
+        }
+      nlabel += job[i].label == nlabel;
+      job[i].nbucket = nbucket;
+      job[i].pc_lo = pc_lo;
+      job[i].pc_hi = pc_hi;
+      if (pthread_create (&thread[i], 0, count_trace, &job[i]))
+        {
+          exit (EXIT_FAILURE);
+        }
+    }
+
+  size_t ncount = 0;
+  for (size_t i = 0; i < ntrace; ++i)
+    {
+      pthread_join (thread[i], 0);
+      if (job[i].error)
+        {
+          fprintf (stderr, "%s: %s\n", job[i].path, strerror (job[i].error));
+          exit (EXIT_FAILURE);
+        }
+      ncount += job[i].table.size;
+    }
+
+  trace_entry *count = malloc (ncount * sizeof (*count));
+  pc_leakage *leakage = malloc (ncount * sizeof (*leakage));
+  uint64_t *label_count = malloc (nlabel * sizeof (*label_count));
+  uint64_t *bucket_count = malloc (nbucket * sizeof (*bucket_count));
+  if ((ncount && (!count || !leakage)) || !label_count || !bucket_count)
+    {
+      exit (EXIT_FAILURE);
+    }
+  ncount = 0;
+  for (size_t i = 0; i < ntrace; ++i)
+    {
+      for (size_t j = 0; j < job[i].table.capacity; ++j)
+        {
+          if (job[i].table.slot[j].count)
+            {
+              count[ncount++] = job[i].table.slot[j];
+            }
+        }
+      free (job[i].table.slot);
+    }
+  if (ncount)
+    {
+      qsort (count, ncount, sizeof (*count), compare_count);
+    }
+
+  /* Merge the counts of traces that share a label. */
+  size_t nmerged = 0;
+  for (size_t i = 0; i < ncount; ++i)
+    {
+      if (nmerged && !compare_count (&count[nmerged - 1], &count[i]))
+        {
+          count[nmerged - 1].count += count[i].count;
+        }
+      else
+        {
+          count[nmerged++] = count[i];
+        }
+    }
+  ncount = nmerged;
+
+  /* Entries of one PC are contiguous, line buckets before page buckets,
+     and the same (PC, key) appears once per label. */
+  size_t npc = 0;
+  for (size_t i = 0; i < ncount;)
+    {
+      pc_leakage *l = &leakage[npc++];
+      l->pc = count[i].pc;
+      l->accesses = 0;
+      for (int g = 0; g < NGRANULARITY; ++g)
+        {
+          size_t end = i;
+          while (end < ncount && count[end].pc == l->pc
+                 && count[end].key / nbucket == (unsigned)g)
+            {
+              if (g == LINE)
+                {
+                  l->accesses += count[end].count;
+                }
+              ++end;
+            }
+          l->bits[g] = mutual_information (&count[i], end - i, nlabel,
+                                           nbucket, label_count,
+                                           bucket_count);
+          i = end;
+        }
+    }
+  if (npc)
+    {
+      qsort (leakage, npc, sizeof (*leakage), compare_leakage);
+    }
+
+  printf ("# pc line_bits page_bits accesses\n");
+  for (size_t i = 0; i < npc; ++i)
+    {
+      printf ("0x%" PRIx64 " %.4f %.4f %" PRIu64 "\n", leakage[i].pc, leakage[i].bits[LINE],
+              leakage[i].bits[PAGE], leakage[i].accesses);
+    }
+  fprintf (stderr, "%zu traces, %zu labels, %zu PCs\n", ntrace, nlabel, npc);
+
+  free (bucket_count);
+  free (label_count);
+  free (leakage);
+  free (count);
+  free (thread);
+  free (job);
+  exit (EXIT_SUCCESS);
+}
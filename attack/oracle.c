@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A long-running victim: serves batches of AES_encrypt over a Unix
+   domain socket so that an attack is not bound by process startup. See
+   oracle.h for the protocol. */
+
+#include <openssl/aes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/random.h>
+#include <time.h>
+
+#include "oracle.h"
+#include "victim.h"
+
+static uint64_t rng_state;
+
+static uint64_t
+now_ns ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64*, fast enough to not show up next to the encryptions. */
+static uint64_t
+next_random ()
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static int
+listen_unix (const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen (path) >= sizeof (addr.sun_path))
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+  strcpy (addr.sun_path, path);
+  unlink (path);
+
+  int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    {
+      return -1;
+    }
+  if (bind (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0
+      || listen (fd, 1) < 0)
+    {
+      close (fd);
+      return -1;
+    }
+  return fd;
+}
+
+/* Serve one client until it hangs up or sends a bad request. */
+static void
+serve (int fd, const AES_KEY *key_struct, uint32_t max_batch, uint8_t *plain,
+       uint8_t *cipher)
+{
+  oracle_request request;
+  while (!oracle_read (fd, &request, sizeof (request)))
+    {
+      if (request.count > max_batch || request.source > ORACLE_RANDOM)
+        {
+          fprintf (stderr, "bad request: count %u source %u\n",
+                   request.count, request.source);
+          return;
+        }
+
+      size_t size = (size_t)request.count * ORACLE_BLOCK_SIZE;
+      switch (request.source)
+        {
+        case ORACLE_ZERO:
+          memset (plain, 0, size);
+          break;
+        case ORACLE_GIVEN:
+          if (oracle_read (fd, plain, size) < 0)
+            {
+              return;
+            }
+          break;
+        case ORACLE_RANDOM:
+          for (size_t i = 0; i < size; i += sizeof (uint64_t))
+            {
+              uint64_t r = next_random ();
+              memcpy (plain + i, &r, sizeof (r));
+            }
+          break;
+        }
+
+      oracle_reply reply = { .count = request.count,
+                             .source = request.source };
+      reply.begin_ns = now_ns ();
+      for (size_t i = 0; i < size; i += ORACLE_BLOCK_SIZE)
+        {
+          AES_encrypt (plain + i, cipher + i, key_struct);
+        }
+      reply.end_ns = now_ns ();
+
+      if (oracle_write (fd, &reply, sizeof (reply)) < 0
+          || oracle_write (fd, plain, size) < 0
+          || oracle_write (fd, cipher, size) < 0)
+        {
+          return;
+        }
+    }
+}
+
+static void
+usage (const char *prog)
+{
+  fprintf (stderr,
+           "usage: %s [-k KEYFILE] [-b MAXBATCH] SOCKET\n"
+           "  -k KEYFILE  read the AES key from KEYFILE\n"
+           "  -b MAXBATCH largest batch served in one request "
+           "(default 4096)\n",
+           prog);
+}
+
+int
+main (int argc, char *argv[argc + 1])
+{
+  uint32_t max_batch = 4096;
+
+  int opt;
+  while ((opt = getopt (argc, argv, "k:b:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'k':
+          if (read_key (optarg) < 0)
+            {
+              perror (optarg);
+              exit (EXIT_FAILURE);
+            }
+          break;
+        case 'b':
+          max_batch = strtoul (optarg, 0, 0);
+          if (!max_batch)
+            {
+              usage (argv[0]);
+              exit (EXIT_FAILURE);
+            }
+          break;
+        default:
+          usage (argv[0]);
+          exit (EXIT_FAILURE);
+        }
+    }
+  if (optind + 1 != argc)
+    {
+      usage (argv[0]);
+      exit (EXIT_FAILURE);
+    }
+  const char *path = argv[optind];
+
+  if (getrandom (&rng_state, sizeof (rng_state), 0) != sizeof (rng_state)
+      || !rng_state)
+    {
+      rng_state = now_ns () | 1;
+    }
+
+  AES_KEY key_struct;
+  AES_set_encrypt_key (key, 128, &key_struct);
+
+  uint8_t *plain = malloc ((size_t)max_batch * ORACLE_BLOCK_SIZE);
+  uint8_t *cipher = malloc ((size_t)max_batch * ORACLE_BLOCK_SIZE);
+  if (!plain || !cipher)
+    {
+      exit (EXIT_FAILURE);
+    }
+
+  signal (SIGPIPE, SIG_IGN);
+  int server = listen_unix (path);
+  if (server < 0)
+    {
+      perror (path);
+      exit (EXIT_FAILURE);
+    }
+
+  for (;;)
+    {
+      int client = accept (server, 0, 0);
+      if (client < 0)
+        {
+          if (errno == EINTR)
+            {
+              continue;
+            }
+          perror ("accept");
+          break;
+        }
+      serve (client, &key_struct, max_batch, plain, cipher);
+      close (client);
+    }
+
+  close (server);
+  unlink (path);
+  free (cipher);
+  free (plain);
+  exit (EXIT_FAILURE);
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Protocol of the encryption oracle and the client side of it.
+
+   A client sends an oracle_request, followed by COUNT plaintext blocks
+   when the source is ORACLE_GIVEN. The oracle answers with an
+   oracle_reply followed by the COUNT plaintext blocks it encrypted and
+   then the COUNT ciphertext blocks. */
+
+#ifndef ORACLE_H
+#define ORACLE_H
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define ORACLE_BLOCK_SIZE (16)
+
+enum oracle_source
+{
+  ORACLE_ZERO,
+  ORACLE_GIVEN,
+  ORACLE_RANDOM,
+};
+
+typedef struct oracle_request
+{
+  uint32_t count;
+  uint32_t source;
+} oracle_request;
+
+/* BEGIN_NS and END_NS are CLOCK_MONOTONIC times taken right before the
+   first and right after the last encryption of the batch. */
+typedef struct oracle_reply
+{
+  uint32_t count;
+  uint32_t source;
+  uint64_t begin_ns;
+  uint64_t end_ns;
+} oracle_reply;
+
+static inline int
+oracle_read (int fd, void *buf, size_t size)
+{
+  for (char *p = buf; size;)
+    {
+      ssize_t n = read (fd, p, size);
+      if (n < 0 && errno == EINTR)
+        {
+          continue;
+        }
+      if (n <= 0)
+        {
+          return -1;
+        }
+      p += n;
+      size -= n;
+    }
+  return 0;
+}
+
+static inline int
+oracle_write (int fd, const void *buf, size_t size)
+{
+  for (const char *p = buf; size;)
+    {
+      ssize_t n = write (fd, p, size);
+      if (n < 0 && errno == EINTR)
+        {
+          continue;
+        }
+      if (n <= 0)
+        {
+          return -1;
+        }
+      p += n;
+      size -= n;
+    }
+  return 0;
+}
+
+static inline int
+oracle_connect (const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen (path) >= sizeof (addr.sun_path))
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+  strcpy (addr.sun_path, path);
+
+  int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    {
+      return -1;
+    }
+  if (connect (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0)
+    {
+      close (fd);
+      return -1;
+    }
+  return fd;
+}
+
+/* Encrypt COUNT blocks from SOURCE. PLAIN is read for ORACLE_GIVEN and
+   filled with the blocks the oracle used otherwise; CIPHER receives the
+   ciphertexts. */
+static inline int
+oracle_query (int fd, uint32_t source, uint32_t count, uint8_t *plain,
+              uint8_t *cipher, oracle_reply *reply)
+{
+  oracle_request request = { .count = count, .source = source };
+  size_t size = (size_t)count * ORACLE_BLOCK_SIZE;
+  if (oracle_write (fd, &request, sizeof (request)) < 0
+      || (source == ORACLE_GIVEN && oracle_write (fd, plain, size) < 0)
+      || oracle_read (fd, reply, sizeof (*reply)) < 0
+      || reply->count != count || oracle_read (fd, plain, size) < 0
+      || oracle_read (fd, cipher, size) < 0)
+    {
+      return -1;
+    }
+  return 0;
+}
+
+#endif
@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A public-key victim: runs COUNT RSA private operations, DH key
+   agreements or ECDSA signatures with one key. Each operation feeds the
+   next, so none of them can be skipped. The secret is the RSA private
+   exponent, the DH private key or the ECDSA nonce. A KEYFILE fixes the
+   RSA key, the DH group or the EC key across runs. */
+
+#include <openssl/bn.h>
+#include <openssl/dh.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/err.h>
+#include <openssl/obj_mac.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+enum algorithm
+{
+  RSA_PRIVATE,
+  DH_AGREE,
+  ECDSA_SIGN,
+};
+
+static const char *const algorithms[] = { "rsa", "dh", "ecdsa" };
+
+typedef struct curve
+{
+  int bits;
+  int nid;
+} curve;
+
+static const curve curves[] = {
+  { 224, NID_secp224r1 },
+  { 256, NID_X9_62_prime256v1 },
+  { 384, NID_secp384r1 },
+  { 521, NID_secp521r1 },
+};
+
+/* Read the key of ALG from the PEM file PATH, or make a BITS-bit one
+   when PATH is null. */
+void *
+load_key (enum algorithm alg, const char *path, int bits)
+{
+  FILE *file = 0;
+  if (path && !(file = fopen (path, "r")))
+    {
+      return 0;
+    }
+
+  void *key = 0;
+  switch (alg)
+    {
+    case RSA_PRIVATE:
+      if (file)
+        {
+          key = PEM_read_RSAPrivateKey (file, 0, 0, 0);
+        }
+      else
+        {
+          RSA *rsa = RSA_new ();
+          BIGNUM *e = BN_new ();
+          BN_set_word (e, RSA_F4);
+          if (rsa && e && RSA_generate_key_ex (rsa, bits, e, 0))
+            {
+              key = rsa;
+            }
+          else
+            {
+              RSA_free (rsa);
+            }
+          BN_free (e);
+        }
+      break;
+    case DH_AGREE:
+      {
+        DH *dh = 0;
+        if (file)
+          {
+            dh = PEM_read_DHparams (file, 0, 0, 0);
+          }
+        else if (bits == 1024)
+          {
+            dh = DH_get_1024_160 ();
+          }
+        else if (bits == 2048)
+          {
+            dh = DH_get_2048_256 ();
+          }
+        else if ((dh = DH_new ())
+                 && !DH_generate_parameters_ex (dh, bits, DH_GENERATOR_2, 0))
+          {
+            DH_free (dh);
+            dh = 0;
+          }
+        if (dh && DH_generate_key (dh))
+          {
+            key = dh;
+          }
+        else
+          {
+            DH_free (dh);
+          }
+      }
+      break;
+    case ECDSA_SIGN:
+      {
+        EC_KEY *ec = 0;
+        if (file)
+          {
+            ec = PEM_read_ECPrivateKey (file, 0, 0, 0);
+          }
+        else
+          {
+            for (size_t i = 0; i < sizeof (curves) / sizeof (*curves); ++i)
+              {
+                if (curves[i].bits == bits)
+                  {
+                    ec = EC_KEY_new_by_curve_name (curves[i].nid);
+                  }
+              }
+            if (ec && !EC_KEY_generate_key (ec))
+              {
+                EC_KEY_free (ec);
+                ec = 0;
+              }
+          }
+        key = ec;
+      }
+      break;
+    }
+
+  if (file)
+    {
+      fclose (file);
+    }
+  return key;
+}
+
+/* Run COUNT private operations with KEY, chaining them through BUF of
+   LEN bytes, and return the number of bytes of the last result. */
+size_t
+run (enum algorithm alg, void *key, size_t count, unsigned char *buf,
+     size_t len)
+{
+  size_t n = 0;
+  switch (alg)
+    {
+    case RSA_PRIVATE:
+      for (size_t i = 0; i < count; ++i)
+        {
+          /* Keep the input below the modulus. */
+          buf[0] = 0;
+          int r = RSA_private_encrypt (len, buf, buf, key, RSA_NO_PADDING);
+          if (r < 0)
+            {
+              return 0;
+            }
+          n = r;
+        }
+      break;
+    case DH_AGREE:
+      {
+        /* Agree with a made-up peer first and then with the shared
+           secret before as the peer's public key, which stays in the
+           group. Only our private key is secret. */
+        DH *peer = DHparams_dup (key);
+        BIGNUM *pub = 0;
+        if (peer && DH_generate_key (peer))
+          {
+            const BIGNUM *peer_pub;
+            DH_get0_key (peer, &peer_pub, 0);
+            pub = BN_dup (peer_pub);
+          }
+        DH_free (peer);
+        if (!pub)
+          {
+            return 0;
+          }
+        for (size_t i = 0; i < count; ++i)
+          {
+            int r = DH_compute_key_padded (buf, pub, key);
+            if (r < 0 || !BN_bin2bn (buf, r, pub))
+              {
+                BN_free (pub);
+                return 0;
+              }
+            n = r;
+          }
+        BN_free (pub);
+      }
+      break;
+    case ECDSA_SIGN:
+      for (size_t i = 0; i < count; ++i)
+        {
+          /* Sign the r of the signature before. */
+          ECDSA_SIG *sig = ECDSA_do_sign (buf, 32, key);
+          if (!sig)
+            {
+              return 0;
+            }
+          const BIGNUM *r;
+          ECDSA_SIG_get0 (sig, &r, 0);
+          memset (buf, 0, len);
+          n = BN_bn2bin (r, buf);
+          ECDSA_SIG_free (sig);
+        }
+      break;
+    }
+  return n;
+}
+
+void
+usage (const char *prog)
+{
+  fprintf (stderr,
+           "usage: %s [-a rsa|dh|ecdsa] [-b BITS] [-u] [-n COUNT] "
+           "[KEYFILE]\n"
+           "  -a ALG    RSA private operations, DH key agreements or ECDSA\n"
+           "            signatures (default rsa)\n"
+           "  -b BITS   modulus size of a made-up RSA key or DH group\n"
+           "            (default 2048; DH groups other than 1024 and 2048\n"
+           "            are generated, which is slow), or the size of the\n"
+           "            ECDSA curve: 224, 256, 384 or 521 (default 256)\n"
+           "  -u        turn RSA blinding off\n"
+           "  -n COUNT  number of operations (default 10)\n"
+           "  KEYFILE   PEM RSA private key, DH parameters or EC private\n"
+           "            key to use instead of a made-up one\n",
+           prog);
+}
+
+int
+main (int argc, char *argv[argc + 1])
+{
+  enum algorithm alg = RSA_PRIVATE;
+  int bits = 0;
+  int unblinded = 0;
+  size_t count = 10;
+
+  int opt;
+  while ((opt = getopt (argc, argv, "a:b:un:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'a':
+          alg = sizeof (algorithms) / sizeof (*algorithms);
+          for (size_t i = 0; i < sizeof (algorithms) / sizeof (*algorithms);
+               ++i)
+            {
+              if (!strcmp (optarg, algorithms[i]))
+                {
+                  alg = i;
+                }
+            }
+          if (alg == sizeof (algorithms) / sizeof (*algorithms))
+            {
+              usage (argv[0]);
+              exit (EXIT_FAILURE);
+            }
+          break;
+        case 'b':
+          bits = strtol (optarg, 0, 0);
+          break;
+        case 'u':
+          unblinded = 1;
+          break;
+        case 'n':
+          count = strtoull (optarg, 0, 0);
+          break;
+        default:
+          usage (argv[0]);
+          exit (EXIT_FAILURE);
+        }
+    }
+  if (!bits)
+    {
+      bits = alg == ECDSA_SIGN ? 256 : 2048;
+    }
+  if (optind + 1 < argc || bits < 0 || (unblinded && alg != RSA_PRIVATE))
+    {
+      usage (argv[0]);
+      exit (EXIT_FAILURE);
+    }
+  const char *path = optind < argc ? argv[optind] : 0;
+
+  void *key = load_key (alg, path, bits);
+  if (!key)
+    {
+      if (path && ERR_peek_error ())
+        {
+          fprintf (stderr, "%s: cannot read key\n", path);
+          ERR_print_errors_fp (stderr);
+        }
+      else if (path)
+        {
+          perror (path);
+        }
+      else
+        {
+          usage (argv[0]);
+        }
+      exit (EXIT_FAILURE);
+    }
+
+  size_t len = 0;
+  switch (alg)
+    {
+    case RSA_PRIVATE:
+      if (unblinded)
+        {
+          RSA_blinding_off (key);
+          RSA_set_flags (key, RSA_FLAG_NO_BLINDING);
+        }
+      len = RSA_size (key);
+      break;
+    case DH_AGREE:
+      len = DH_size (key);
+      break;
+    case ECDSA_SIGN:
+      len = ECDSA_size (key);
+      break;
+    }
+
+  /* Any start but zero, which RSA maps to itself. */
+  unsigned char *buf = malloc (len);
+  if (!buf)
+    {
+      exit (EXIT_FAILURE);
+    }
+  memset (buf, 0x5a, len);
+
+  size_t n = run (alg, key, count, buf, len);
+  if (!n && count)
+    {
+      fprintf (stderr, "%s failed\n", algorithms[alg]);
+      exit (EXIT_FAILURE);
+    }
+  for (size_t i = 0; i < n; ++i)
+    {
+      printf ("%02x", buf[i]);
+    }
+  printf ("\n");
+
+  free (buf);
+  switch (alg)
+    {
+    case RSA_PRIVATE:
+      RSA_free (key);
+      break;
+    case DH_AGREE:
+      DH_free (key);
+      break;
+    case ECDSA_SIGN:
+      EC_KEY_free (key);
+      break;
+    }
+  exit (EXIT_SUCCESS);
+}
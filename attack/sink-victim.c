@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* One leak of every sink class in a single routine: a secret used as a
+   memory address, as a branch condition, as a DIV operand and as an
+   indirect call target. */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char s[8];
+
+static unsigned char a[256 * 64];
+
+static void
+even ()
+{
+}
+
+static void
+odd ()
+{
+}
+
+static void (*const handler[2]) () = { even, odd };
+
+void
+leak ()
+{
+  for (size_t i = 0; i < sizeof (s); ++i)
+    {
+      unsigned long x = (unsigned char)s[i];
+
+      asm volatile("movq (%0), %%rax\n" : : "c"(a + x * 64) : "rax");
+
+      asm volatile("testq $1, %0\n"
+                   "jz 1f\n"
+                   "nop\n"
+                   "1:\n"
+                   :
+                   : "r"(x)
+                   : "cc");
+
+      unsigned long q = 1UL << 32;
+      asm volatile("xorl %%edx, %%edx\n"
+                   "divq %1\n"
+                   : "+a"(q)
+                   : "r"(x | 1)
+                   : "rdx", "cc");
+
+      handler[x & 1]();
+    }
+}
+
+int
+main (int argc, char *argv[argc + 1])
+{
+  if (argc > 1)
+    {
+      const char *secret = argv[1];
+      memcpy (s, secret,
+              strlen (secret) < sizeof (s) ? strlen (secret) : sizeof (s));
+    }
+  leak ();
+  exit (EXIT_SUCCESS);
+}
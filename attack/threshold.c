@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threshold.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+/* A fit needs this many samples, each cluster this share of them, and
+   the means this many standard deviations apart; two halves of one
+   cluster are not. */
+#define MIN_SAMPLES (64)
+#define MIN_WEIGHT (0.005)
+#define MIN_SEPARATION (2)
+#define KMEANS_ROUNDS (16)
+
+static double
+bin_cycles (size_t b)
+{
+  return (b + 0.5) * THRESHOLD_BIN_CYCLES;
+}
+
+static size_t
+cycles_bin (unsigned cycles)
+{
+  size_t b = cycles / THRESHOLD_BIN_CYCLES;
+  return b < THRESHOLD_NBIN ? b : THRESHOLD_NBIN - 1;
+}
+
+static double
+log_gaussian (double x, double weight, double mean, double sd)
+{
+  double z = (x - mean) / sd;
+  return log (weight) - log (sd) - z * z / 2;
+}
+
+/* Fit M to its histogram, starting from the threshold of the last fit
+   or else from the mean latency. The last bin collects everything
+   slower, interrupts and the like, and is left out. */
+static void
+fit (line_model *m)
+{
+  const double *h = m->hist;
+  double total = 0, mean = 0;
+  for (size_t b = 0; b < THRESHOLD_NBIN - 1; ++b)
+    {
+      total += h[b];
+      mean += h[b] * bin_cycles (b);
+    }
+  int refit = m->fitted;
+  m->fitted = 0;
+  if (total < MIN_SAMPLES)
+    {
+      return;
+    }
+
+  /* 2-means on the bins: a bin below SPLIT belongs to the hits. N and
+     SUM are always those of the final SPLIT, converged or not. */
+  size_t split = refit ? cycles_bin (m->threshold)
+                       : cycles_bin (mean / total) + 1;
+  double n[2], sum[2];
+  for (int round = 1;; ++round)
+    {
+      n[0] = n[1] = sum[0] = sum[1] = 0;
+      for (size_t b = 0; b < THRESHOLD_NBIN - 1; ++b)
+        {
+          n[b >= split] += h[b];
+          sum[b >= split] += h[b] * bin_cycles (b);
+        }
+      if (n[0] < MIN_WEIGHT * total || n[1] < MIN_WEIGHT * total)
+        {
+          return;
+        }
+      size_t next = cycles_bin ((sum[0] / n[0] + sum[1] / n[1]) / 2) + 1;
+      if (next == split || round == KMEANS_ROUNDS)
+        {
+          break;
+        }
+      split = next;
+    }
+
+  for (int c = 0; c < 2; ++c)
+    {
+      m->weight[c] = n[c] / total;
+      m->mean[c] = sum[c] / n[c];
+      double var = 0;
+      for (size_t b = c ? split : 0; b < (c ? THRESHOLD_NBIN - 1 : split);
+           ++b)
+        {
+          double d = bin_cycles (b) - m->mean[c];
+          var += h[b] * d * d;
+        }
+      /* A cluster in a single bin still spans the bin. */
+      m->sd[c] = fmax (sqrt (var / n[c]), THRESHOLD_BIN_CYCLES / 2.0);
+    }
+  if (m->mean[1] - m->mean[0] < MIN_SEPARATION * (m->sd[0] + m->sd[1]))
+    {
+      return;
+    }
+
+  /* The first cycle count between the means where a miss is likelier. */
+  unsigned t = ceil (m->mean[0]);
+  while (t < m->mean[1]
+         && log_gaussian (t, m->weight[0], m->mean[0], m->sd[0])
+                > log_gaussian (t, m->weight[1], m->mean[1], m->sd[1]))
+    {
+      ++t;
+    }
+  m->threshold = t;
+  m->fitted = 1;
+}
+
+int
+threshold_init (threshold_model *model, size_t nline, unsigned initial,
+                double decay)
+{
+  model->line = calloc (nline, sizeof (*model->line));
+  if (!model->line)
+    {
+      return -1;
+    }
+  model->nline = nline;
+  model->initial = initial;
+  model->decay = decay;
+  model->pooled = (line_model){ .threshold = initial };
+  for (size_t i = 0; i < nline; ++i)
+    {
+      model->line[i].threshold = initial;
+    }
+  return 0;
+}
+
+void
+threshold_free (threshold_model *model)
+{
+  free (model->line);
+}
+
+void
+threshold_add (threshold_model *model, const uint16_t *latency)
+{
+  for (size_t i = 0; i < model->nline; ++i)
+    {
+      size_t b = cycles_bin (latency[i]);
+      model->line[i].hist[b] += 1;
+      model->pooled.hist[b] += 1;
+    }
+}
+
+void
+threshold_update (threshold_model *model, unsigned *threshold)
+{
+  fit (&model->pooled);
+  unsigned fallback
+      = model->pooled.fitted ? model->pooled.threshold : model->initial;
+  for (size_t i = 0; i < model->nline; ++i)
+    {
+      line_model *m = &model->line[i];
+      fit (m);
+      threshold[i] = m->fitted ? m->threshold : fallback;
+      for (size_t b = 0; b < THRESHOLD_NBIN; ++b)
+        {
+          m->hist[b] *= model->decay;
+        }
+    }
+  for (size_t b = 0; b < THRESHOLD_NBIN; ++b)
+    {
+      model->pooled.hist[b] *= model->decay;
+    }
+}
+
+void
+threshold_confusion (const threshold_model *model, double *false_hit,
+                     double *false_miss)
+{
+  size_t nfitted = 0;
+  *false_hit = *false_miss = 0;
+  for (size_t i = 0; i < model->nline; ++i)
+    {
+      const line_model *m = &model->line[i];
+      if (!m->fitted)
+        {
+          continue;
+        }
+      ++nfitted;
+      *false_hit
+          += erfc ((m->mean[1] - m->threshold) / (m->sd[1] * M_SQRT2)) / 2;
+      *false_miss
+          += erfc ((m->threshold - m->mean[0]) / (m->sd[0] * M_SQRT2)) / 2;
+    }
+  if (nfitted)
+    {
+      *false_hit /= nfitted;
+      *false_miss /= nfitted;
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Adaptive hit/miss thresholds for flush+reload.
+
+   Every probed line keeps a histogram of its reload latencies that
+   decays at each update, so that it follows frequency scaling and
+   co-runners. An update fits two clusters to each histogram, the hits
+   and the misses, with 2-means followed by a Gaussian fit to each, and
+   puts the threshold where the two weighted Gaussians cross. A line
+   that has not seen both hits and misses yet uses the threshold fitted
+   to the histogram of all lines together. The Gaussians also give the
+   expected rate of each kind of misclassification. */
+
+#ifndef THRESHOLD_H
+#define THRESHOLD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define THRESHOLD_NBIN (256)
+#define THRESHOLD_BIN_CYCLES (4)
+/* Samples between refits, and the weight the latencies seen before keep
+   at each refit. raccoon and replay both use these, so that a replay
+   adapts as the recorded run did. */
+#define THRESHOLD_PERIOD (256)
+#define THRESHOLD_DECAY (0.5)
+
+typedef struct line_model
+{
+  double hist[THRESHOLD_NBIN];
+  /* Cluster 0 is the hits, cluster 1 the misses. */
+  double weight[2];
+  double mean[2];
+  double sd[2];
+  unsigned threshold;
+  int fitted;
+} line_model;
+
+typedef struct threshold_model
+{
+  size_t nline;
+  line_model *line;
+  line_model pooled;
+  unsigned initial;
+  double decay;
+} threshold_model;
+
+/* Model NLINE lines, all at threshold INITIAL until fitted. Each update
+   scales the histograms by DECAY. */
+int threshold_init (threshold_model *model, size_t nline, unsigned initial,
+                    double decay);
+void threshold_free (threshold_model *model);
+
+/* Account the reload latencies of one sample, LATENCY[I] for line I. */
+void threshold_add (threshold_model *model, const uint16_t *latency);
+
+/* Refit every line and store its threshold in THRESHOLD[I]. */
+void threshold_update (threshold_model *model, unsigned *threshold);
+
+/* The expected fraction of misses taken as hits and of hits taken as
+   misses, averaged over the fitted lines. */
+void threshold_confusion (const threshold_model *model, double *false_hit,
+                          double *false_miss);
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Helpers shared by the tools that read pinatrace-style address
+   traces. */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+static inline uint64_t
+mix (uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+/* Parse "PC: R ADDR". Returns 0 on success and -1 on any other line,
+   such as pinatrace's trailing "#eof". */
+static inline int
+parse_access (const char *line, uint64_t *pc, uint64_t *addr)
+{
+  char *end;
+  *pc = strtoull (line, &end, 16);
+  if (end == line || *end != ':')
+    {
+      return -1;
+    }
+  line = end + 1;
+  while (*line == ' ')
+    {
+      ++line;
+    }
+  if (*line != 'R' && *line != 'W')
+    {
+      return -1;
+    }
+  *addr = strtoull (line + 1, &end, 16);
+  return end == line + 1 ? -1 : 0;
+}
+
+/* An open-addressing table of counts per PC and KEY, where KEY tells
+   apart the entries of one PC and VALUE is for the caller. An entry is
+   in use once its COUNT is nonzero. */
+typedef struct trace_entry
+{
+  uint64_t pc;
+  uint64_t key;
+  uint64_t value;
+  uint64_t count;
+} trace_entry;
+
+typedef struct trace_table
+{
+  trace_entry *slot;
+  size_t capacity;
+  size_t size;
+} trace_table;
+
+static inline int
+trace_table_init (trace_table *table, size_t capacity)
+{
+  table->slot = calloc (capacity, sizeof (*table->slot));
+  table->capacity = capacity;
+  table->size = 0;
+  return table->slot ? 0 : -1;
+}
+
+/* The entry of PC and KEY, or the free slot where it would go. */
+static inline trace_entry *
+trace_table_find (const trace_table *table, uint64_t pc, uint64_t key)
+{
+  size_t mask = table->capacity - 1;
+  for (size_t i = mix (pc ^ mix (key)) & mask;; i = (i + 1) & mask)
+    {
+      trace_entry *e = &table->slot[i];
+      if ((e->pc == pc && e->key == key) || !e->count)
+        {
+          return e;
+        }
+    }
+}
+
+static inline int
+trace_table_grow (trace_table *table)
+{
+  trace_table bigger;
+  if (trace_table_init (&bigger, table->capacity * 2) < 0)
+    {
+      return -1;
+    }
+  for (size_t i = 0; i < table->capacity; ++i)
+    {
+      const trace_entry *e = &table->slot[i];
+      if (e->count)
+        {
+          *trace_table_find (&bigger, e->pc, e->key) = *e;
+        }
+    }
+  bigger.size = table->size;
+  free (table->slot);
+  *table = bigger;
+  return 0;
+}
+
+/* The entry of PC and KEY, claiming a zeroed one if there is none yet;
+   the caller counts it before the next call. Returns null when out of
+   memory. */
+static inline trace_entry *
+trace_table_get (trace_table *table, uint64_t pc, uint64_t key)
+{
+  if (2 * (table->size + 1) > table->capacity
+      && trace_table_grow (table) < 0)
+    {
+      return 0;
+    }
+  trace_entry *e = trace_table_find (table, pc, key);
+  if (!e->count)
+    {
+      *e = (trace_entry){ .pc = pc, .key = key };
+      ++table->size;
+    }
+  return e;
+}
+
+#endif
@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Differential address traces.
+
+   Each trace is a pinatrace-style text file with one memory access per
+   line, "PC: R ADDR" or "PC: W ADDR", recorded from the same program
+   under a different secret. Traces are aligned per PC: the k-th access
+   of a PC in one trace is compared with the k-th access of the same PC
+   in the others, so a divergence at one PC does not shift the
+   comparison of the rest. Every trace is reduced in its own thread to a
+   per-PC access count and a digest of the PC's address sequence, which
+   keeps memory bounded by the number of distinct PCs rather than by the
+   trace length. */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+typedef struct trace_job
+{
+  const char *path;
+  unsigned granularity;
+  uint64_t pc_lo;
+  uint64_t pc_hi;
+  trace_table table;
+  uint64_t accesses;
+  int error;
+} trace_job;
+
+static void *
+reduce_trace (void *arg)
+{
+  trace_job *job = arg;
+  FILE *file = fopen (job->path, "r");
+  if (!file || trace_table_init (&job->table, 1 << 12) < 0)
+    {
+      job->error = errno;
+      if (file)
+        {
+          fclose (file);
+        }
+      return 0;
+    }
+  setvbuf (file, 0, _IOFBF, 1 << 20);
+
+  char *line = 0;
+  size_t cap = 0;
+  while (getline (&line, &cap, file) > 0)
+    {
+      uint64_t pc, addr;
+      if (parse_access (line, &pc, &addr) < 0 || pc < job->pc_lo
+          || pc >= job->pc_hi)
+        {
+          continue;
+        }
+      trace_entry *e = trace_table_get (&job->table, pc, 0);
+      if (!e)
+        {
+          job->error = ENOMEM;
+          break;
+        }
+      e->value = mix (e->value ^ (addr >> job->granularity));
+      ++e->count;
+      ++job->accesses;
+    }
+  if (ferror (file))
+    {
+      job->error = errno;
+    }
+  free (line);
+  fclose (file);
+  return 0;
+}
+
+static int
+compare_pc (const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void
+usage (const char *prog)
+{
+  fprintf (stderr,
+           "usage: %s [-g BITS] [-r LO:HI] TRACE TRACE...\n"
+           "  -g BITS   compare addresses with the low BITS bits dropped,\n"
+           "            e.g. 6 for 64-byte cache lines (default 0)\n"
+           "  -r LO:HI  only consider PCs in [LO, HI), in hex\n",
+           prog);
+}
+
+int
+main (int argc, char *argv[argc + 1])
+{
+  unsigned granularity = 0;
+  uint64_t pc_lo = 0, pc_hi = UINT64_MAX;
+
+  int opt;
+  while ((opt = getopt (argc, argv, "g:r:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'g':
+          granularity = strtoul (optarg, 0, 0);
+          if (granularity > 63)
+            {
+              usage (argv[0]);
+              exit (EXIT_FAILURE);
+            }
+          break;
+        case 'r':
+          if (sscanf (optarg, "%" SCNx64 ":%" SCNx64, &pc_lo, &pc_hi) != 2)
+            {
+              usage (argv[0]);
+              exit (EXIT_FAILURE);
+            }
+          break;
+        default:
+          usage (argv[0]);
+          exit (EXIT_FAILURE);
+        }
+    }
+
+  size_t ntrace = argc - optind;
+  if (ntrace < 2)
+    {
+      usage (argv[0]);
+      exit (EXIT_FAILURE);
+    }
+
+  trace_job *job = calloc (ntrace, sizeof (*job));
+  pthread_t *thread = calloc (ntrace, sizeof (*thread));
+  if (!job || !thread)
+    {
+      exit (EXIT_FAILURE);
+    }
+  for (size_t i = 0; i < ntrace; ++i)
+    {
+      job[i].path = argv[optind + i];
+      job[i].granularity = granularity;
+      job[i].pc_lo = pc_lo;
+      job[i].pc_hi = pc_hi;
+      if (pthread_create (&thread[i], 0, reduce_trace, &job[i]))
+        {
+          exit (EXIT_FAILURE);
+        }
+    }
+  for (size_t i = 0; i < ntrace; ++i)
+    {
+      pthread_join (thread[i], 0);
+      if (job[i].error)
+        {
+          fprintf (stderr, "%s: %s\n", job[i].path, strerror (job[i].error));
+          exit (EXIT_FAILURE);
+        }
+    }
+
+  size_t npc = 0;
+  for (size_t i = 0; i < ntrace; ++i)
+    {
+      npc += job[i].table.size;
+    }
+  uint64_t *pc = malloc (npc * sizeof (*pc));
+  if (npc && !pc)
+    {
+      exit (EXIT_FAILURE);
+    }
+  npc = 0;
+  for (size_t i = 0; i < ntrace; ++i)
+    {
+      for (size_t j = 0; j < job[i].table.capacity; ++j)
+        {
+          if (job[i].table.slot[j].count)
+            {
+              pc[npc++] = job[i].table.slot[j].pc;
+            }
+        }
+    }
+  if (npc)
+    {
+      qsort (pc, npc, sizeof (*pc), compare_pc);
+    }
+
+  /* A PC leaks through its address sequence when every trace executes
+     it equally often but the digests differ, and through control flow
+     when the counts themselves differ. */
+  size_t nleak = 0, ndistinct = 0;
+  for (size_t i = 0; i < npc; ++i)
+    {
+      if (i && pc[i] == pc[i - 1])
+        {
+          continue;
+        }
+      ++ndistinct;
+      const trace_entry *first = trace_table_find (&job[0].table, pc[i], 0);
+      int count_differs = 0, hash_differs = 0;
+      for (size_t j = 1; j < ntrace; ++j)
+        {
+          const trace_entry *e = trace_table_find (&job[j].table, pc[i], 0);
+          count_differs |= e->count != first->count;
+          hash_differs |= e->value != first->value;
+        }
+      if (!count_differs && !hash_differs)
+        {
+          continue;
+        }
+      ++nleak;
+      printf ("0x%" PRIx64 " %s", pc[i], count_differs ? "count" : "addr");
+      for (size_t j = 0; j < ntrace; ++j)
+        {
+          printf (" %" PRIu64, trace_table_find (&job[j].table, pc[i], 0)->count);
+        }
+      printf ("\n");
+    }
+
+  for (size_t i = 0; i < ntrace; ++i)
+    {
+      fprintf (stderr, "%s: %" PRIu64 " accesses\n", job[i].path, job[i].accesses);
+      free (job[i].table.slot);
+    }
+  fprintf (stderr, "%zu of %zu PCs differ\n", nleak, ndistinct);
+
+  free (pc);
+  free (thread);
+  free (job);
+  exit (EXIT_SUCCESS);
+}
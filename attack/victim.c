@@ -18,19 +18,86 @@
 #include <openssl/aes.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "doorbell.h"
+#include "victim.h"
 
-const char key[16] = "sEcRet";
 char in[17] = {};
 
 int
-main ()
+main (int argc, char *argv[argc + 1])
 {
+  size_t count = 10;
+  doorbell *bell = 0;
+
+  int opt;
+  while ((opt = getopt (argc, argv, "n:d:")) != -1)
+    {
+      switch (opt)
+        {
+        case 'n':
+          count = strtoull (optarg, 0, 0);
+          break;
+        case 'd':
+          bell = doorbell_open (optarg);
+          if (!bell)
+            {
+              perror (optarg);
+              exit (EXIT_FAILURE);
+            }
+          break;
+        default:
+          fprintf (stderr, "usage: %s [-n COUNT] [-d DOORBELL] [KEYFILE]\n",
+                   argv[0]);
+          exit (EXIT_FAILURE);
+        }
+    }
+  if (optind < argc && read_key (argv[optind]) < 0)
+    {
+      perror (argv[optind]);
+      exit (EXIT_FAILURE);
+    }
+
+  /* Carry on from the last request value of the doorbell, or from the
+     last request done when the victim before closed it, so that an
+     attacker that saw an earlier victim cannot mistake an old request
+     for a new one. */
+  uint32_t request = 0;
+  if (bell)
+    {
+      request = atomic_load (&bell->request.value);
+      if (request == DOORBELL_CLOSED)
+        {
+          request = atomic_load (&bell->done);
+        }
+    }
   AES_KEY key_struct;
   AES_set_encrypt_key ((const unsigned char *)key, 128, &key_struct);
-  for (size_t i = 0; i < 10; ++i)
+  for (size_t i = 0; i < count; ++i)
     {
+      request = request >= DOORBELL_CLOSED - 2 ? 1 : (request | 1) + 2;
+      if (bell)
+        {
+          memcpy (bell->plain, in, 16);
+          bell_ring (&bell->request, request);
+          doorbell_wait_ack (bell, request);
+        }
       AES_encrypt ((const unsigned char *)in, (unsigned char *)in,
                    &key_struct);
+      if (bell)
+        {
+          memcpy (bell->cipher, in, 16);
+          atomic_store (&bell->done, request);
+          bell_ring (&bell->request, request + 1);
+        }
+    }
+  if (bell)
+    {
+      bell_ring (&bell->request, DOORBELL_CLOSED);
+      doorbell_close (bell);
     }
   printf ("%s\n", in);
 }
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2022  Xiaoyue Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The secret key shared by the victims: built in, or read from a key
+   file. */
+
+#ifndef VICTIM_H
+#define VICTIM_H
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+static unsigned char key[16] = "sEcRet";
+
+/* Read the key with a plain read(2) so that a syscall taint source sees
+   the secret enter the process, just like a service loading its key. A
+   short file leaves the rest of the key zero. */
+static inline int
+read_key (const char *path)
+{
+  int fd = open (path, O_RDONLY);
+  if (fd < 0)
+    {
+      return -1;
+    }
+  memset (key, 0, sizeof (key));
+  ssize_t n = read (fd, key, sizeof (key));
+  close (fd);
+  return n < 0 ? -1 : 0;
+}
+
+#endif